@@ -0,0 +1,96 @@
+#include "clustergis.h"
+
+#define PARCELS_GEOMETRY_COLUMN 1
+#define EMPLOYERS_GEOMETRY_COLUMN 1
+#define LAND_USE_COLUMN 2
+
+/* report
+ *
+ * Prints one result line on rank 0: phase, tasks, threads, records handled
+ * over all tasks, and the least, mean and greatest time of the tasks
+ *
+ * phase - name of the timed phase
+ * seconds - time this task spent in the phase
+ * records - records this task handled in the phase
+ */
+static void report(char* phase, double seconds, long long records) {
+	double minimum;
+	double maximum;
+	double sum;
+	long long total;
+	int rank;
+	int tasks;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &tasks);
+
+	MPI_Reduce(&seconds, &minimum, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+	MPI_Reduce(&seconds, &maximum, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+	MPI_Reduce(&seconds, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	MPI_Reduce(&records, &total, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	if(rank == 0) {
+		printf("%s,%d,%d,%lld,%f,%f,%f\n", phase, tasks, clusterGIS_Get_threads(), total, minimum, sum / tasks, maximum);
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char** argv) {
+	clusterGIS_dataset* parcels;
+	clusterGIS_dataset* employers;
+	clusterGIS_dataset* output;
+	GEOSGeometry* box;
+	double start;
+	int rank;
+
+	if(argc != 4) {
+		fprintf(stderr, "Usage: %s parcels employers output\n", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	/* one csv line per phase, every phase starts together */
+	if(rank == 0) {
+		printf("phase,tasks,threads,records,min,mean,max\n");
+	}
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = MPI_Wtime();
+	parcels = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+	report("load", MPI_Wtime() - start, parcels->size);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = MPI_Wtime();
+	clusterGIS_Create_wkt_geometries(parcels, PARCELS_GEOMETRY_COLUMN);
+	report("parse", MPI_Wtime() - start, parcels->size);
+
+	/* every task needs all employers for the nearest join */
+	employers = clusterGIS_Load_csv_replicated(MPI_COMM_WORLD, argv[2]);
+	clusterGIS_Create_wkt_geometries(employers, EMPLOYERS_GEOMETRY_COLUMN);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = MPI_Wtime();
+	output = clusterGIS_Nearest_join(employers, parcels, MPI_COMM_WORLD, 0, 0, LAND_USE_COLUMN);
+	report("nearest", MPI_Wtime() - start, rank == 0 ? output->size : 0);
+	clusterGIS_Free_dataset(output);
+	clusterGIS_Free_dataset(employers);
+
+	/* the central part of the region the generator fills */
+	box = GEOSGeom_createRectangle_r(clusterGIS_geos.handle, -112.15, 33.35, -111.95, 33.55);
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = MPI_Wtime();
+	clusterGIS_Filter_geometry(parcels, box, CLUSTERGIS_PREDICATE_INTERSECTS);
+	report("filter", MPI_Wtime() - start, parcels->size);
+	GEOSGeom_destroy_r(clusterGIS_geos.handle, box);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	start = MPI_Wtime();
+	clusterGIS_Write_csv_distributed(MPI_COMM_WORLD, argv[3], parcels);
+	report("write", MPI_Wtime() - start, parcels->size);
+
+	clusterGIS_Free_dataset(parcels);
+	clusterGIS_Finalize();
+	return 0;
+}
@@ -0,0 +1,26 @@
+#!/usr/bin/python
+
+from fabricate import *
+
+programs = ['bench']
+
+library = ['../src/clustergis', '../src/clustergis_index', '../src/clustergis_partition', '../src/clustergis_join', '../src/clustergis_threads', '../src/clustergis_binary', '../src/clustergis_simd', '../src/clustergis_stats', '../src/clustergis_aggregate']
+
+def build():
+	for program in programs:
+		sources = [program] + library
+		compile(sources)
+		link(sources, program)
+
+def compile(sources):
+	for source in sources:
+		run('mpicc -Wall -O3 -pthread -I../src/ `geos-config --cflags` -c ' + source + '.c -o ' + source + '.o')
+
+def link(sources, program='a.out'):
+	objects = ' '.join(s + '.o' for s in sources)
+	run('mpicc -o ' + program + ' -Wall -O3 -pthread `geos-config --cflags` ' + objects + ' `geos-config --ldflags` -lgeos_c')
+
+def clean():
+	autoclean()
+
+main()
@@ -0,0 +1,60 @@
+#!/usr/bin/python
+
+"""Writes a synthetic parcel or employer csv file in the format the examples
+expect to standard output.
+
+Usage: generate.py parcels|employers count [skew] [seed]
+
+Parcels are "id","POLYGON(...)","land use code","zone" and employers are
+"id","POINT(...)","land use code". Records are scattered over a region
+around Phoenix; skew (0 to 1, default 0) is the fraction of them crowded
+around a few centres instead, where parcels are also smaller. Files made
+with the same seed share their centres, so employers crowd where parcels do.
+"""
+
+import random
+import sys
+
+XMIN, YMIN, XMAX, YMAX = -112.3, 33.2, -111.8, 33.7
+CENTRES = 5
+CODES = 'RRRRCCIA'
+
+def position(centres, skew):
+	if random.random() < skew:
+		x, y, spread = random.choice(centres)
+		x = min(max(random.gauss(x, spread), XMIN), XMAX)
+		y = min(max(random.gauss(y, spread), YMIN), YMAX)
+		return x, y, True
+	return random.uniform(XMIN, XMAX), random.uniform(YMIN, YMAX), False
+
+def parcel(i, x, y, crowded):
+	size = 0.0003 if crowded else 0.002
+	w = random.uniform(0.1, 1) * size
+	h = random.uniform(0.1, 1) * size
+	ring = [(x, y), (x + w, y), (x + w, y + h), (x, y + h), (x, y)]
+	wkt = 'POLYGON((%s))' % ','.join('%r %r' % point for point in ring)
+	return '"%d","%s","%s","%d"\n' % (1000000 + i, wkt, random.choice(CODES), random.randint(1, 99))
+
+def employer(i, x, y, crowded):
+	return '"%d","POINT(%r %r)","%s"\n' % (5000000 + i, x, y, random.choice(CODES))
+
+def main():
+	if len(sys.argv) < 3 or sys.argv[1] not in ('parcels', 'employers'):
+		sys.stderr.write('Usage: %s parcels|employers count [skew] [seed]\n' % sys.argv[0])
+		sys.exit(1)
+	kind = sys.argv[1]
+	count = int(sys.argv[2])
+	skew = float(sys.argv[3]) if len(sys.argv) > 3 else 0.0
+	seed = int(sys.argv[4]) if len(sys.argv) > 4 else 1
+
+	random.seed(seed)
+	centres = [(random.uniform(XMIN, XMAX), random.uniform(YMIN, YMAX), random.uniform(0.005, 0.03)) for i in range(CENTRES)]
+	random.seed(seed * 2 + (kind == 'employers'))
+
+	record = parcel if kind == 'parcels' else employer
+	out = sys.stdout
+	for i in range(count):
+		x, y, crowded = position(centres, skew)
+		out.write(record(i, x, y, crowded))
+
+main()
@@ -0,0 +1,33 @@
+#include "clustergis.h"
+
+#define PARCELS_GEOMETRY_COLUMN 1
+#define LAND_USE_COLUMN 2
+#define ZONE_COLUMN 3
+
+int main(int argc, char** argv) {
+	clusterGIS_dataset* parcels;
+	clusterGIS_dataset* output;
+	int group_columns[1] = {LAND_USE_COLUMN};
+	int functions[4] = {CLUSTERGIS_AGGREGATE_COUNT, CLUSTERGIS_AGGREGATE_AREA, CLUSTERGIS_AGGREGATE_MIN, CLUSTERGIS_AGGREGATE_MAX};
+	int columns[4] = {-1, -1, ZONE_COLUMN, ZONE_COLUMN};
+
+	if(argc != 3) {
+		fprintf(stderr, "Usage %s input output", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+
+	parcels = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+	clusterGIS_Defer_wkt_geometries(parcels, PARCELS_GEOMETRY_COLUMN);
+
+	/* count, total area and zone range of the parcels of each land use code */
+	output = clusterGIS_Aggregate(MPI_COMM_WORLD, parcels, group_columns, 1, functions, columns, 4);
+
+	clusterGIS_Write_csv_distributed(MPI_COMM_WORLD, argv[2], output);
+
+	clusterGIS_Free_dataset(output);
+	clusterGIS_Free_dataset(parcels);
+	clusterGIS_Finalize();
+	return 0;
+}
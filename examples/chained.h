@@ -1 +0,0 @@
-void min_distance_function (double *invec, double* outvec, int *len, MPI_Datatype *datatype);
@@ -8,7 +8,6 @@
 
 int main(int argc, char** argv) {
 	clusterGIS_dataset* dataset;
-	clusterGIS_record* record;
 	int rank;
 
 	/* Process local arguments */
@@ -21,12 +20,10 @@ int main(int argc, char** argv) {
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 	dataset = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
 
-	/* adds a new record to the beginning of the dataset */
+	/* adds a new record to the dataset */
 	if(rank == 0) {
 		int start = 0;
-		record = clusterGIS_Create_record_from_csv("97123897,POINT(0 0),C\n", &start);
-		record->next = dataset->data;
-		dataset->data = record;
+		clusterGIS_Append_record_from_csv(dataset, "97123897,POINT(0 0),C\n", &start);
 	}
 
 	/* writes the records to disk */
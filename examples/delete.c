@@ -9,8 +9,8 @@
 
 int main(int argc, char** argv) {
 	clusterGIS_dataset* dataset;
-	clusterGIS_record* record;
-	clusterGIS_record** head;
+	int record;
+	char* keep;
 
 	/* Process local arguments */
 	if (argc != 3) {
@@ -22,19 +22,13 @@ int main(int argc, char** argv) {
 	clusterGIS_Init(&argc, &argv);
 	dataset = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
 
-	record = dataset->data;
-	head = &(dataset->data);
 	/* keep records that match the criteria, otherwise delete them */
-	while(record != NULL) {
-		if(atoi(record->data[0]) == 1008130) {
-			*head = record->next;
-			clusterGIS_Free_record(record);
-			record = *head;
-		} else {
-			head = &(record->next);
-			record = record->next;
-		}
+	keep = malloc(dataset->size);
+	for(record = 0; record < dataset->size; record++) {
+		keep[record] = atoi(clusterGIS_Get_field(dataset, record, 0)) != 1008130;
 	}
+	clusterGIS_Keep_records(dataset, keep);
+	free(keep);
 
 	clusterGIS_Write_csv_distributed(MPI_COMM_WORLD, argv[2], dataset);
 
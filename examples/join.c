@@ -0,0 +1,42 @@
+#include "clustergis.h"
+
+#define EMPLOYERS_GEOMETRY_COLUMN 1
+#define PARCELS_GEOMETRY_COLUMN 1
+
+int main(int argc, char** argv) {
+	char* employers_filename;
+	char* parcels_filename;
+	clusterGIS_dataset* employers;
+	clusterGIS_dataset* parcels;
+	int world_rank;
+	clusterGIS_dataset* output = NULL;
+	char* output_filename;
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+	if(argc != 4 && world_rank == 0) {
+		printf("Usage: %s employers parcels output\n", argv[0]);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	employers_filename = argv[1];
+	parcels_filename = argv[2];
+	output_filename = argv[3];
+
+	/* Both layers are simply split over all tasks, the join moves the records it needs */
+	employers = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, employers_filename);
+	clusterGIS_Defer_wkt_geometries(employers, EMPLOYERS_GEOMETRY_COLUMN);
+	parcels = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, parcels_filename);
+	clusterGIS_Create_wkt_geometries(parcels, PARCELS_GEOMETRY_COLUMN);
+
+	/* Find the parcel every employer lies in */
+	output = clusterGIS_Spatial_join(MPI_COMM_WORLD, employers, parcels, 0, 0, CLUSTERGIS_PREDICATE_WITHIN);
+
+	clusterGIS_Write_csv_distributed(MPI_COMM_WORLD, output_filename, output);
+
+	clusterGIS_Free_dataset(output);
+	clusterGIS_Free_dataset(parcels);
+	clusterGIS_Free_dataset(employers);
+	clusterGIS_Finalize();
+	return 0;
+}
@@ -9,7 +9,7 @@
 
 int main(int argc, char** argv) {
 	clusterGIS_dataset* dataset;
-	clusterGIS_record* record;
+	int record;
 
 	/* Process local arguments */
 	if (argc != 3) {
@@ -21,13 +21,11 @@ int main(int argc, char** argv) {
 	clusterGIS_Init(&argc, &argv);
 	dataset =  clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
 
-	record = dataset->data;
-	/* keep records that match the criteria, otherwise delete them */
-	while(record != NULL) {
-		if(atoi(record->data[0]) == 1008130) {
-			record->data[2] = "C";
+	/* change the land use code of the matching record */
+	for(record = 0; record < dataset->size; record++) {
+		if(atoi(clusterGIS_Get_field(dataset, record, 0)) == 1008130) {
+			clusterGIS_Set_field(dataset, record, 2, "C");
 		}
-		record = record->next;
 	}
 
 	clusterGIS_Write_csv_distributed(MPI_COMM_WORLD, argv[2], dataset);
@@ -1,18 +1,57 @@
 #include "clustergis.h"
+#include "clustergis_internal.h"
 #include "string.h"
-#include "sys/stat.h"
 #include "assert.h"
+#include "float.h"
+#include <sys/mman.h>
+
+/* most bytes read at a time past the end of a load range, to finish its last record */
+#define CLUSTERGIS_TAIL_BUFFERSIZE (64*1024)
+
+/* bytes in front of the memory of each arena block, keeps it 16 byte aligned */
+#define CLUSTERGIS_ARENA_HEADER ((sizeof(clusterGIS_arena_block) + 15) & ~((size_t) 15))
+
+int clusterGIS_started = 0;
+clusterGIS_context clusterGIS_geos;
+
+static char* clusterGIS_Split_csv_field(char* csv, int* i, int* length);
+static void clusterGIS_Create_wkt_range(clusterGIS_context* context, int start, int end, void* arg);
+static void clusterGIS_Materialize_range(clusterGIS_context* context, int start, int end, void* arg);
+static int clusterGIS_Load_test(clusterGIS_dataset* dataset, int record, clusterGIS_load_options* options);
+static char* clusterGIS_Projected_columns(clusterGIS_load_options* options, int* last);
+static void clusterGIS_Load_dynamic(MPI_Comm comm, MPI_File file, MPI_Offset filesize, clusterGIS_dataset* dataset, clusterGIS_load_options* options);
+static void clusterGIS_Load_range(MPI_File file, MPI_Offset filesize, MPI_Offset rangestart, MPI_Offset rangeend, clusterGIS_dataset* dataset, clusterGIS_load_options* options);
+static void clusterGIS_Start_range(clusterGIS_csv_stream* range, MPI_File file, MPI_Offset filesize, MPI_Offset rangestart, MPI_Offset rangeend, clusterGIS_load_options* options);
+static void clusterGIS_Read_block(clusterGIS_csv_stream* range, char** buffer, MPI_Offset* offset, MPI_Request* request);
+static void clusterGIS_Split_block(clusterGIS_csv_stream* range, char* buffer, MPI_Offset offset, int count, clusterGIS_dataset* dataset);
+static void clusterGIS_Split_end(clusterGIS_csv_stream* range, clusterGIS_dataset* dataset);
+static int clusterGIS_Find_slot(clusterGIS_dictionary* dictionary, const char* value, int length);
+static void clusterGIS_Group_codes(clusterGIS_dataset* dataset);
+static int clusterGIS_Compare_values(const void* a, const void* b);
+
+/* field of columns left out by a projection, see clusterGIS_load_options */
+static char clusterGIS_empty_field[1] = "";
 
 /* clusterGIS_Init
  *
- * Sets up the clusterGIS environment
+ * Sets up the clusterGIS environment. The number of threads per task is
+ * taken from the CLUSTERGIS_THREADS environment variable, default 1.
  *
  * argc - count of arguments in argv
  * argv - char** of arguments
  */
 void clusterGIS_Init(int* argc, char*** argv) {
-	MPI_Init(argc, argv);
-	initGEOS(NULL, NULL);
+	int provided;
+	char* threads;
+
+	/* only the main thread makes MPI calls */
+	MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+	clusterGIS_Create_context(&clusterGIS_geos);
+
+	threads = getenv("CLUSTERGIS_THREADS");
+	if(threads != NULL) {
+		clusterGIS_Set_threads(atoi(threads));
+	}
 
 	clusterGIS_started = 1;
 }
@@ -22,8 +61,9 @@ void clusterGIS_Init(int* argc, char*** argv) {
  * Closes out the clusterGIS environment
  */
 void clusterGIS_Finalize(void) {
+	clusterGIS_Set_threads(1);
 	MPI_Finalize();
-	finishGEOS();
+	clusterGIS_Free_context(&clusterGIS_geos);
 }
 
 /* dataset operations */
@@ -34,7 +74,38 @@ void clusterGIS_Finalize(void) {
  */
 clusterGIS_dataset* clusterGIS_Create_dataset(void) {
 	clusterGIS_dataset* dataset = malloc(sizeof(clusterGIS_dataset));
+	dataset->size = 0;
+	dataset->capacity = 0;
+	dataset->offsets = malloc(sizeof(size_t));
+	dataset->offsets[0] = 0;
+	dataset->values = NULL;
+	dataset->lengths = NULL;
+	dataset->values_capacity = 0;
+	dataset->geometries = NULL;
+	dataset->pending = NULL;
+	dataset->geometry_column = -1;
+	dataset->index = NULL;
+	dataset->envelopes.xmin = NULL;
+	dataset->envelopes.size = 0;
+	dataset->dictionary.column = -1;
+	dataset->dictionary.size = 0;
+	dataset->dictionary.values = NULL;
+	dataset->dictionary.codes = NULL;
+	dataset->dictionary.starts = NULL;
+	dataset->dictionary.records = NULL;
+	dataset->dictionary.slots = NULL;
+	dataset->dictionary.sorted = NULL;
+	dataset->dictionary.slots_count = 0;
+	dataset->dictionary.indexes = NULL;
+	dataset->extents = NULL;
+	dataset->extents_count = 0;
+	dataset->arena.blocks = NULL;
+	dataset->arena.allocated = 0;
+	dataset->views = NULL;
 	dataset->data = NULL;
+	dataset->mapping = NULL;
+	dataset->mapping_size = 0;
+	dataset->window = MPI_WIN_NULL;
 
 	return dataset;
 }
@@ -48,299 +119,1968 @@ clusterGIS_dataset* clusterGIS_Create_dataset(void) {
  * dataset - the dataset which will be created
  */
 clusterGIS_dataset* clusterGIS_Load_csv_distributed(MPI_Comm comm, char* filename) {
+	return clusterGIS_Load_csv_distributed_options(comm, filename, NULL);
+}
+
+/* clusterGIS_Create_load_options
+ *
+ * Creates load options which keep every row
+ */
+clusterGIS_load_options* clusterGIS_Create_load_options(void) {
+	clusterGIS_load_options* options = malloc(sizeof(clusterGIS_load_options));
+	options->value_column = -1;
+	options->prefix = NULL;
+	options->window_column = -1;
+	options->window[0] = 0;
+	options->window[1] = 0;
+	options->window[2] = 0;
+	options->window[3] = 0;
+	options->columns = NULL;
+	options->columns_count = 0;
+	options->chunk_size = 0;
+	options->buffers = 2;
+	options->buffer_size = CLUSTERGIS_BUFFERSIZE;
+	options->encode_column = -1;
+
+	return options;
+}
+
+/* clusterGIS_Free_load_options
+ *
+ * Frees load options, but not the strings and columns they point to
+ *
+ * options - the options to be freed
+ */
+void clusterGIS_Free_load_options(clusterGIS_load_options* options) {
+	free(options);
+}
+
+/* clusterGIS_Load_csv_distributed_options
+ *
+ * Loads a portion of a dataset on each task, see
+ * clusterGIS_Load_csv_distributed, keeping only the rows which pass the
+ * tests in options and the columns they list
+ *
+ * comm - MPI communicator to use
+ * filename - path to the dataset
+ * options - load options, or NULL to keep every row and column
+ *
+ * Returns the local part of the dataset
+ */
+clusterGIS_dataset* clusterGIS_Load_csv_distributed_options(MPI_Comm comm, char* filename, clusterGIS_load_options* options) {
 	MPI_File file;
 	int err;
-	char* buffer;
-	MPI_Status status;
-	clusterGIS_record** record;
-	MPI_Offset offset;
-	MPI_Offset chunkstart;
-	MPI_Offset chunkend;
-	int count;
+	MPI_Offset rangestart;
+	MPI_Offset rangeend;
 	MPI_Offset filesize;
-	int i;
-	int start;
-	int end;
 	clusterGIS_dataset* dataset;
 	int comm_rank;
 	int comm_size;
+	double start;
 
+	start = clusterGIS_Start_timer();
 	MPI_Comm_rank(comm, &comm_rank);
 	MPI_Comm_size(comm, &comm_size);
 
 	err = MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
 	assert(err == MPI_SUCCESS);
 
-	buffer = (char*) malloc(CLUSTERGIS_BUFFERSIZE);
 	MPI_File_get_size(file, &filesize);
-	offset = 0;
-	dataset = (clusterGIS_dataset*) malloc(sizeof(clusterGIS_dataset));
-	record = &dataset->data;
+	dataset = clusterGIS_Create_dataset();
+
+	if(options != NULL && options->chunk_size > 0) {
+		clusterGIS_Load_dynamic(comm, file, filesize, dataset, options);
+		MPI_File_close(&file);
+		if(options->encode_column >= 0) {
+			clusterGIS_Encode_column(dataset, options->encode_column);
+		}
+		clusterGIS_Stop_timer(CLUSTERGIS_STAT_LOAD_TIME, start);
+		return dataset;
+	}
+
+	/* each task loads the records starting in its share of the file */
+	rangestart = filesize * comm_rank / comm_size;
+	rangeend = filesize * (comm_rank + 1) / comm_size;
+	clusterGIS_Load_range(file, filesize, rangestart, rangeend, dataset, options);
 
-	/* determine chunksizes, last task picks up the slack */
-	chunkstart = comm_rank * (filesize / comm_size);
-	if (comm_rank == comm_size - 1) {
-		chunkend = filesize;
-	} else { 
-		chunkend = chunkstart + (filesize / comm_size) - 1;
+	MPI_File_close(&file);
+	if(options != NULL && options->encode_column >= 0) {
+		clusterGIS_Encode_column(dataset, options->encode_column);
+	}
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_LOAD_TIME, start);
+
+	return dataset;
+}
+
+/* clusterGIS_Load_dynamic
+ *
+ * Loads the chunks of a file this task claims from a counter shared by the
+ * tasks in comm, see clusterGIS_load_options
+ *
+ * comm - MPI communicator of the tasks loading the file
+ * file - the open file
+ * filesize - size of the file in bytes
+ * dataset - the dataset the records are added to
+ * options - load options, with the chunk size
+ */
+static void clusterGIS_Load_dynamic(MPI_Comm comm, MPI_File file, MPI_Offset filesize, clusterGIS_dataset* dataset, clusterGIS_load_options* options) {
+	MPI_Win window;
+	long long* counter;
+	long long one = 1;
+	long long chunk;
+	int comm_rank;
+	double start;
+
+	MPI_Comm_rank(comm, &comm_rank);
+
+	MPI_Win_allocate(comm_rank == 0 ? sizeof(long long) : 0, sizeof(long long), MPI_INFO_NULL, comm, &counter, &window);
+	if(comm_rank == 0) {
+		*counter = 0;
+	}
+	MPI_Barrier(comm);
+
+	MPI_Win_lock_all(0, window);
+	while(1) {
+		start = clusterGIS_Start_timer();
+		MPI_Fetch_and_op(&one, &chunk, MPI_LONG_LONG, 0, 0, MPI_SUM, window);
+		MPI_Win_flush(0, window);
+		clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, start);
+		if(chunk * options->chunk_size >= filesize) {
+			break;
+		}
+		clusterGIS_Load_range(file, filesize, chunk * options->chunk_size, (chunk + 1) * options->chunk_size < filesize ? (chunk + 1) * options->chunk_size : filesize, dataset, options);
+	}
+	MPI_Win_unlock_all(window);
+	MPI_Win_free(&window);
+}
+
+/* clusterGIS_Load_range
+ *
+ * Loads the records which start in a range of a file. Blocks of the file
+ * are read with MPI_File_iread_at into a ring of buffers, so the next
+ * blocks are read while one is split, see clusterGIS_Split_block.
+ *
+ * file - the open file
+ * filesize - size of the file in bytes
+ * rangestart - offset of the first byte of the range
+ * rangeend - offset after the last byte of the range
+ * dataset - the dataset the records are added to
+ * options - load options with the buffer count and size, or NULL
+ */
+static void clusterGIS_Load_range(MPI_File file, MPI_Offset filesize, MPI_Offset rangestart, MPI_Offset rangeend, clusterGIS_dataset* dataset, clusterGIS_load_options* options) {
+	clusterGIS_csv_stream range;
+	MPI_Request* requests;
+	MPI_Offset* offsets;
+	MPI_Status status;
+	MPI_Offset offset;
+	char** buffers;
+	char* buffer;
+	int slots;
+	int issued;
+	int next;
+	int slot;
+	int count;
+	double start;
+
+	clusterGIS_Start_range(&range, file, filesize, rangestart, rangeend, options);
+	if(range.buffer_size <= 0) {
+		return;
+	}
+
+	slots = options != NULL && options->buffers > 0 ? options->buffers : 2;
+	requests = malloc(slots * sizeof(MPI_Request));
+	offsets = malloc(slots * sizeof(MPI_Offset));
+	buffers = malloc(slots * sizeof(char*));
+
+	/* fill the pipeline */
+	issued = 0;
+	while(issued < slots && range.position < rangeend) {
+		clusterGIS_Read_block(&range, &buffers[issued], &offsets[issued], &requests[issued]);
+		issued++;
 	}
 
-	offset = chunkstart;
-	while(offset < chunkend - 1) {
-		MPI_File_read_at(file, offset, buffer, CLUSTERGIS_BUFFERSIZE, MPI_CHAR, &status);
+	next = 0;
+	while(next < issued) {
+		slot = next % slots;
+		start = clusterGIS_Start_timer();
+		MPI_Wait(&requests[slot], &status);
+		clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, start);
 		MPI_Get_count(&status, MPI_CHAR, &count);
+		clusterGIS_Count(CLUSTERGIS_STAT_BYTES_READ, count);
+		buffer = buffers[slot];
+		offset = offsets[slot];
+		next++;
+
+		/* read the next block while this one is split */
+		if(!range.finished && range.position < rangeend) {
+			clusterGIS_Read_block(&range, &buffers[slot], &offsets[slot], &requests[slot]);
+			issued++;
+		}
 
-		/* determine the start of this record set */
-		start = 0;
-		if (offset == chunkstart && comm_rank != 0) {
-			while(buffer[start] != '\n' && start < count) {
-				start++;
-			}
-			if(start == count) {
-				fprintf(stderr, "%d: buffer is too small\n",comm_rank);
-				MPI_Abort(MPI_COMM_WORLD, 1);
-			}
-			start++;
+		clusterGIS_Split_block(&range, buffer, offset, count, dataset);
+
+		/* past the range, read on only to finish the last record */
+		if(!range.finished && next == issued && range.position < filesize) {
+			slot = next % slots;
+			clusterGIS_Read_block(&range, &buffers[slot], &offsets[slot], &requests[slot]);
+			issued++;
 		}
+	}
+	clusterGIS_Split_end(&range, dataset);
+
+	free(requests);
+	free(offsets);
+	free(buffers);
+}
+
+/* clusterGIS_Start_range
+ *
+ * Sets up the state of splitting a range of a file into records. The byte
+ * before the range is read too, to tell whether a record starts at its
+ * first byte; buffer_size is 0 if the range is empty.
+ *
+ * range - the state to set up
+ * file - the open file
+ * filesize - size of the file in bytes
+ * rangestart - offset of the first byte of the range
+ * rangeend - offset after the last byte of the range
+ * options - load options with the buffer size, or NULL
+ */
+static void clusterGIS_Start_range(clusterGIS_csv_stream* range, MPI_File file, MPI_Offset filesize, MPI_Offset rangestart, MPI_Offset rangeend, clusterGIS_load_options* options) {
+	range->file = file;
+	range->filesize = filesize;
+	range->rangestart = rangestart;
+	range->rangeend = rangeend;
+	range->position = rangestart > 0 ? rangestart - 1 : 0;
+	range->options = options;
+	range->buffer_size = options != NULL && options->buffer_size > 0 ? options->buffer_size : (CLUSTERGIS_BUFFERSIZE);
+	if(rangeend - range->position < range->buffer_size) {
+		range->buffer_size = rangeend > range->position ? rangeend - range->position : 0;
+	}
+	range->carry = NULL;
+	range->carried = 0;
+	range->previous = '\n';
+	range->started = rangestart == 0;
+	range->finished = range->buffer_size == 0;
+	range->buffer = NULL;
+	range->request = MPI_REQUEST_NULL;
+}
+
+/* clusterGIS_Read_block
+ *
+ * Starts reading the next block of a range into a new buffer
+ *
+ * range - the range being split
+ * buffer - set to the new buffer
+ * offset - set to the offset of the block
+ * request - set to the request of the read
+ */
+static void clusterGIS_Read_block(clusterGIS_csv_stream* range, char** buffer, MPI_Offset* offset, MPI_Request* request) {
+	int size;
 
-		/* determine the end of this record set */
-		end = count - 1;
-		while(end > 0 && buffer[end] != '\n') {
-			end--;
+	/* never read past the end of the file, not every MPI-IO completes short non-blocking reads */
+	size = range->buffer_size;
+	if(range->position >= range->rangeend && size > CLUSTERGIS_TAIL_BUFFERSIZE) {
+		size = CLUSTERGIS_TAIL_BUFFERSIZE;
+	}
+	if(range->filesize - range->position < size) {
+		size = range->filesize - range->position;
+	}
+	*buffer = clusterGIS_Arena_create_buffer(size);
+	*offset = range->position;
+	MPI_File_iread_at(range->file, range->position, *buffer, size, MPI_CHAR, request);
+	range->position += size;
+}
+
+/* clusterGIS_Split_block
+ *
+ * Adds the records of the next block of a range to a dataset. Records are
+ * split in place in the block, except for the one the block ends in the
+ * middle of, which is joined up with the start of the next block. Blocks
+ * are read on past the range to the end of its last record, after which
+ * the range is finished. The block is retained by the dataset or freed.
+ *
+ * range - the range being split
+ * buffer - the block
+ * offset - offset of the block in the file
+ * count - bytes in the block
+ * dataset - the dataset the records are added to
+ */
+static void clusterGIS_Split_block(clusterGIS_csv_stream* range, char* buffer, MPI_Offset offset, int count, clusterGIS_dataset* dataset) {
+	int start;
+	int end;
+
+	start = 0;
+	if(!range->started) {
+		/* a record starts at the start of the file or after a '\n' */
+		start = range->rangestart > offset ? range->rangestart - offset : 0;
+		while(start < count && (start > 0 ? buffer[start - 1] : range->previous) != '\n') {
+			start++;
 		}
-		if(end == 0) {
-			fprintf(stderr, "%d: \\n not found from end\n", comm_rank);
-			MPI_Abort(MPI_COMM_WORLD, 1);
+		range->started = start < count;
+	} else if(range->carry != NULL) {
+		/* finish the record the previous block ended in */
+		while(start < count && buffer[start] != '\n') {
+			start++;
 		}
-		end++;
+		if(start < count) {
+			start++;
+		}
+		range->carry = clusterGIS_Arena_grow_buffer(range->carry, range->carried + start + 1);
+		memcpy(range->carry + range->carried, buffer, start);
+		range->carried += start;
+		if(range->carry[range->carried - 1] == '\n') {
+			clusterGIS_Add_csv_records(dataset, range->carry, 0, range->carried, range->options);
+			range->carry = NULL;
+			range->carried = 0;
+		}
+	}
+	if(count > 0) {
+		range->previous = buffer[count - 1];
+	}
 
-		if(chunkend - offset < count) {
-			/* Buffer overruns the responsibility of this task */
-			end = chunkend - offset + 1;
-			while(end < count && buffer[end] != '\n') {
-				end++;
+	if(range->started && range->carry == NULL && !range->finished && start < count) {
+		if(offset + start >= range->rangeend) {
+			/* the rest belongs to the next range */
+			range->finished = 1;
+		} else {
+			end = count;
+			while(end > start && buffer[end - 1] != '\n') {
+				end--;
 			}
-			end++;
-			if (end > count - 1) {
-				end = chunkend - offset + 1;
-				while(end > 0 && buffer[end] != '\n') {
-					end--;
-				}
-				if(end == 0) {
-					fprintf(stderr, "%d: \\n not found from end\n", comm_rank);
-					MPI_Abort(MPI_COMM_WORLD, 1);
+			if(offset + end >= range->rangeend) {
+				/* stop after the record holding the last byte of the range */
+				end = range->rangeend - offset - 1;
+				while(buffer[end] != '\n') {
+					end++;
 				}
 				end++;
+				range->finished = 1;
+			} else if(end < count) {
+				range->carried = count - end;
+				range->carry = clusterGIS_Arena_create_buffer(range->carried + 1);
+				memcpy(range->carry, buffer + end, range->carried);
+			}
+			if(end > start) {
+				clusterGIS_Add_csv_records(dataset, buffer, start, end, range->options);
+				return;
 			}
 		}
+	}
+	clusterGIS_Arena_free_buffer(buffer);
+}
 
-		/* Put the records into the dataset */
-		i = start;
-		while (i < end) {
-			(*record) = clusterGIS_Create_record_from_csv(buffer, &i);
-			(*record)->next = NULL;
-			record = &(*record)->next;
-			i++;
+/* clusterGIS_Split_end
+ *
+ * Adds the record a range ends in to a dataset, after the last block of
+ * the file was split. The last record of a file may have no '\n'.
+ *
+ * range - the range being split
+ * dataset - the dataset the record is added to
+ */
+static void clusterGIS_Split_end(clusterGIS_csv_stream* range, clusterGIS_dataset* dataset) {
+	if(range->carry != NULL) {
+		range->carry[range->carried] = '\n';
+		clusterGIS_Add_csv_records(dataset, range->carry, 0, range->carried + 1, range->options);
+		range->carry = NULL;
+		range->carried = 0;
+	}
+	range->finished = 1;
+}
+
+/* clusterGIS_Open_csv_stream
+ *
+ * Opens a csv file for reading one batch of records at a time, see
+ * clusterGIS_Next_batch. Each task reads the records starting in its share
+ * of the file, like clusterGIS_Load_csv_distributed, but only holds one
+ * batch of them in memory.
+ *
+ * comm - MPI communicator of the tasks reading the file
+ * filename - the name of the file to read
+ */
+clusterGIS_csv_stream* clusterGIS_Open_csv_stream(MPI_Comm comm, char* filename) {
+	return clusterGIS_Open_csv_stream_options(comm, filename, NULL);
+}
+
+/* clusterGIS_Open_csv_stream_options
+ *
+ * Opens a csv file for reading one batch of records at a time, keeping
+ * only the records and columns options selects. A batch is made from one
+ * block of buffer_size bytes; chunk_size and buffers are not used. options
+ * is used by every batch, so it must outlive the stream.
+ *
+ * comm - MPI communicator of the tasks reading the file
+ * filename - the name of the file to read
+ * options - load options, or NULL
+ */
+clusterGIS_csv_stream* clusterGIS_Open_csv_stream_options(MPI_Comm comm, char* filename, clusterGIS_load_options* options) {
+	clusterGIS_csv_stream* stream;
+	MPI_File file;
+	MPI_Offset filesize;
+	int err;
+	int comm_rank;
+	int comm_size;
+
+	MPI_Comm_rank(comm, &comm_rank);
+	MPI_Comm_size(comm, &comm_size);
+
+	err = MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+	if(err != MPI_SUCCESS) {
+		fprintf(stderr, "clusterGIS_Open_csv_stream: could not open %s\n", filename);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	MPI_File_get_size(file, &filesize);
+
+	stream = malloc(sizeof(clusterGIS_csv_stream));
+	clusterGIS_Start_range(stream, file, filesize, filesize * comm_rank / comm_size, filesize * (comm_rank + 1) / comm_size, options);
+
+	/* start reading the first batch */
+	if(!stream->finished) {
+		clusterGIS_Read_block(stream, &stream->buffer, &stream->offset, &stream->request);
+	}
+
+	return stream;
+}
+
+/* clusterGIS_Next_batch
+ *
+ * Replaces the records of batch with the next batch of records from a
+ * stream, and returns their number, 0 once the stream is exhausted. The
+ * next block of the file is read while the caller works on the batch.
+ * Geometries are deferred in the new batch if they were in the old one,
+ * see clusterGIS_Clear_dataset.
+ *
+ * stream - the stream to read
+ * batch - the dataset the records are put in
+ */
+int clusterGIS_Next_batch(clusterGIS_csv_stream* stream, clusterGIS_dataset* batch) {
+	MPI_Status status;
+	MPI_Offset offset;
+	char* buffer;
+	int count;
+	double start;
+	double wait;
+
+	start = clusterGIS_Start_timer();
+	clusterGIS_Clear_dataset(batch);
+
+	while(batch->size == 0 && stream->buffer != NULL) {
+		wait = clusterGIS_Start_timer();
+		MPI_Wait(&stream->request, &status);
+		clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, wait);
+		MPI_Get_count(&status, MPI_CHAR, &count);
+		clusterGIS_Count(CLUSTERGIS_STAT_BYTES_READ, count);
+		buffer = stream->buffer;
+		offset = stream->offset;
+		stream->buffer = NULL;
+
+		/* read the next block while this one is split */
+		if(!stream->finished && stream->position < stream->rangeend) {
+			clusterGIS_Read_block(stream, &stream->buffer, &stream->offset, &stream->request);
+		}
+
+		clusterGIS_Split_block(stream, buffer, offset, count, batch);
+
+		/* past the range, read on only to finish the last record */
+		if(!stream->finished && stream->buffer == NULL) {
+			if(stream->position < stream->filesize) {
+				clusterGIS_Read_block(stream, &stream->buffer, &stream->offset, &stream->request);
+			} else {
+				clusterGIS_Split_end(stream, batch);
+			}
+		}
+	}
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_LOAD_TIME, start);
+
+	return batch->size;
+}
+
+/* clusterGIS_Close_csv_stream
+ *
+ * Closes a stream opened by clusterGIS_Open_csv_stream. Collective over the
+ * communicator the stream was opened on.
+ *
+ * stream - the stream to close
+ */
+void clusterGIS_Close_csv_stream(clusterGIS_csv_stream* stream) {
+	if(stream->buffer != NULL) {
+		MPI_Wait(&stream->request, MPI_STATUS_IGNORE);
+		clusterGIS_Arena_free_buffer(stream->buffer);
+	}
+	if(stream->carry != NULL) {
+		clusterGIS_Arena_free_buffer(stream->carry);
+	}
+	MPI_File_close(&stream->file);
+	free(stream);
+}
+
+/* clusterGIS_Load_csv_replicated
+ *
+ * Loads an entire copy of a csv data source on each task included in comm
+ *
+ * comm - MPI communicator of which all members will get a copy of this dataset
+ * filename - path to the csv formatted dataset
+ *
+ * returns a pointer to the dataset
+ */
+clusterGIS_dataset* clusterGIS_Load_csv_replicated(MPI_Comm comm, char* filename) {
+	return clusterGIS_Load_csv_replicated_options(comm, filename, NULL);
+}
+
+/* clusterGIS_Load_csv_replicated_options
+ *
+ * Loads an entire copy of a csv data source on each task included in comm,
+ * see clusterGIS_Load_csv_replicated, keeping only the rows which pass the
+ * tests in options and the columns they list
+ *
+ * comm - MPI communicator of which all members will get a copy of this dataset
+ * filename - path to the csv formatted dataset
+ * options - load options, or NULL to keep every row and column
+ *
+ * returns a pointer to the dataset
+ */
+clusterGIS_dataset* clusterGIS_Load_csv_replicated_options(MPI_Comm comm, char* filename, clusterGIS_load_options* options) {
+	MPI_File file;
+	int err;
+	char* buffer;
+	int buffersize = 2*1024*1024;
+	MPI_Status status;
+	MPI_Offset offset;
+	int count;
+	int last_full_record_end;
+	MPI_Offset filesize;
+	clusterGIS_dataset* dataset;
+	int comm_rank;
+	double start;
+	double wait;
+
+	start = clusterGIS_Start_timer();
+	MPI_Comm_rank(comm, &comm_rank);
+
+	err = MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+	if(err != MPI_SUCCESS) {
+		fprintf(stderr, "%d: Error opening file %s\n", comm_rank, filename);
+		MPI_Abort(comm, err);
+	}
+
+	MPI_File_get_size(file, &filesize);
+	offset = 0;
+	dataset = clusterGIS_Create_dataset();
+
+	while(offset < filesize) {
+		buffer = clusterGIS_Arena_create_buffer(buffersize);
+		wait = clusterGIS_Start_timer();
+		MPI_File_read_at_all(file, offset, buffer, buffersize, MPI_CHAR, &status);
+		clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, wait);
+		MPI_Get_count(&status, MPI_CHAR, &count);
+		clusterGIS_Count(CLUSTERGIS_STAT_BYTES_READ, count);
+	
+		/* find where the last full record ends */
+		last_full_record_end = count - 1;
+		while(buffer[last_full_record_end] != '\n' && last_full_record_end >= 0) {
+			last_full_record_end--;
+		}
+		if(last_full_record_end < 0) {
+			fprintf(stderr, "%d: Error in clusterGIS_Load_data_replicated: buffersize is too small, %d\n", comm_rank, count);
+			MPI_Abort(comm, 1);
 		}
 
-		offset += end;
+		clusterGIS_Add_csv_records(dataset, buffer, 0, last_full_record_end + 1, options);
+
+		offset = offset + last_full_record_end + 1;
+	}
+
+	MPI_File_close(&file);
+	if(options != NULL && options->encode_column >= 0) {
+		clusterGIS_Encode_column(dataset, options->encode_column);
+	}
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_LOAD_TIME, start);
+	
+	return dataset;
+}
+
+/* clusterGIS_Load_csv_shared
+ *
+ * Loads an entire copy of a csv data source on each task included in comm,
+ * keeping one copy of the data per node. One task on each node reads and
+ * splits the file in an MPI shared memory window, and the other tasks on the
+ * node point their fields into the same window, which they must not modify.
+ * Freeing or clearing the dataset is collective over the tasks of the node.
+ *
+ * Only the text of the file is shared. Every task still holds its own
+ * field pointers and lengths, 12 bytes per field, its own record offsets
+ * and geometry pointers, 16 bytes per record, and creates its own
+ * geometries. The field pointers cannot be shared,
+ * because the window is mapped at a different address in each task. The
+ * saving per extra task on a node is therefore the size of the file less
+ * these arrays. It is largest for files with long fields, such as WKT
+ * geometries, and small for files of many short fields.
+ *
+ * comm - MPI communicator of which all members will get a copy of this dataset
+ * filename - path to the csv formatted dataset
+ *
+ * returns a pointer to the dataset
+ */
+clusterGIS_dataset* clusterGIS_Load_csv_shared(MPI_Comm comm, char* filename) {
+	return clusterGIS_Load_csv_shared_options(comm, filename, NULL);
+}
+
+/* clusterGIS_Load_csv_shared_options
+ *
+ * Loads an entire copy of a csv data source on each task included in comm,
+ * see clusterGIS_Load_csv_shared, keeping only the rows which pass the tests
+ * in options and the columns they list. The node's first task tests the
+ * rows as it splits them, so rejected rows cost the other tasks nothing, but
+ * the whole file stays in the window.
+ *
+ * comm - MPI communicator of which all members will get a copy of this dataset
+ * filename - path to the csv formatted dataset
+ * options - load options, or NULL to keep every row and column
+ *
+ * returns a pointer to the dataset
+ */
+clusterGIS_dataset* clusterGIS_Load_csv_shared_options(MPI_Comm comm, char* filename, clusterGIS_load_options* options) {
+	MPI_Comm node;
+	MPI_Win index;
+	MPI_File file;
+	MPI_Offset filesize;
+	MPI_Aint size;
+	int unit;
+	int err;
+	char* buffer;
+	long long* header;
+	size_t* offsets;
+	long long* positions;
+	int* lengths;
+	long long last;
+	long long offset;
+	long long values;
+	char* projected;
+	int last_column;
+	int column;
+	int i;
+	int record;
+	clusterGIS_dataset* dataset;
+	int comm_rank;
+	int node_rank;
+	double start;
+	double wait;
+
+	start = clusterGIS_Start_timer();
+	MPI_Comm_rank(comm, &comm_rank);
+	MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, comm_rank, MPI_INFO_NULL, &node);
+	MPI_Comm_rank(node, &node_rank);
+	dataset = clusterGIS_Create_dataset();
+
+	/* the node's first task reads the whole file into the window */
+	filesize = 0;
+	if(node_rank == 0) {
+		err = MPI_File_open(MPI_COMM_SELF, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+		if(err != MPI_SUCCESS) {
+			fprintf(stderr, "%d: Error opening file %s\n", comm_rank, filename);
+			MPI_Abort(comm, err);
+		}
+		MPI_File_get_size(file, &filesize);
+	}
+	MPI_Win_allocate_shared(node_rank == 0 ? filesize + 2 : 0, 1, MPI_INFO_NULL, node, &buffer, &dataset->window);
+	MPI_Win_shared_query(dataset->window, 0, &size, &unit, &buffer);
+	MPI_Win_lock_all(MPI_MODE_NOCHECK, dataset->window);
+
+	if(node_rank == 0) {
+		clusterGIS_File_read_at_all(file, 0, buffer, filesize);
+		clusterGIS_Count(CLUSTERGIS_STAT_BYTES_READ, filesize);
+		MPI_File_close(&file);
+
+		/* the last record of a file may have no '\n' */
+		last = filesize;
+		if(last > 0 && buffer[last - 1] != '\n') {
+			buffer[last++] = '\n';
+		}
+		buffer[last] = '\0';
+
+		/* split the records in place, dropping the rows the options reject
+		 * and emptying the columns they do not keep */
+		projected = clusterGIS_Projected_columns(options, &last_column);
+		offset = 0;
+		while(offset < last) {
+			i = 0;
+			record = clusterGIS_Parse_csv_record(dataset, buffer + offset, &i);
+			offset += i + 1;
+			if(options != NULL && !clusterGIS_Load_test(dataset, record, options)) {
+				dataset->size--;
+				continue;
+			}
+			if(projected == NULL) {
+				continue;
+			}
+			if(clusterGIS_Get_columns(dataset, record) > last_column + 1) {
+				dataset->offsets[record + 1] = dataset->offsets[record] + last_column + 1;
+			}
+			for(column = 0; column < clusterGIS_Get_columns(dataset, record); column++) {
+				if(!projected[column]) {
+					clusterGIS_Get_field(dataset, record, column) = clusterGIS_empty_field;
+					clusterGIS_Get_length(dataset, record, column) = 0;
+				}
+			}
+		}
+		free(projected);
+	}
+	MPI_Win_sync(dataset->window);
+
+	/* then shares where the fields are, relative to the window */
+	values = dataset->offsets[dataset->size];
+	size = 0;
+	if(node_rank == 0) {
+		size = 2 * sizeof(long long) + (dataset->size + 1) * sizeof(size_t) + values * (sizeof(long long) + sizeof(int));
+	}
+	MPI_Win_allocate_shared(size, 1, MPI_INFO_NULL, node, &header, &index);
+	MPI_Win_shared_query(index, 0, &size, &unit, &header);
+	MPI_Win_lock_all(MPI_MODE_NOCHECK, index);
+	if(node_rank == 0) {
+		header[0] = dataset->size;
+		header[1] = values;
+		offsets = (size_t*) (header + 2);
+		positions = (long long*) (offsets + header[0] + 1);
+		lengths = (int*) (positions + header[1]);
+		memcpy(offsets, dataset->offsets, (dataset->size + 1) * sizeof(size_t));
+		memcpy(lengths, dataset->lengths, values * sizeof(int));
+		for(offset = 0; offset < values; offset++) {
+			positions[offset] = dataset->values[offset] == clusterGIS_empty_field ? -1 : dataset->values[offset] - buffer;
+		}
+	}
+	MPI_Win_sync(index);
+	wait = clusterGIS_Start_timer();
+	MPI_Barrier(node);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, wait);
+	MPI_Win_sync(index);
+	MPI_Win_sync(dataset->window);
+
+	/* the other tasks may only read the header once the first has written it */
+	if(node_rank != 0) {
+		offsets = (size_t*) (header + 2);
+		positions = (long long*) (offsets + header[0] + 1);
+		lengths = (int*) (positions + header[1]);
+		for(record = 0; record < header[0]; record++) {
+			clusterGIS_Add_record(dataset, offsets[record + 1] - offsets[record]);
+		}
+		for(offset = 0; offset < header[1]; offset++) {
+			dataset->values[offset] = positions[offset] < 0 ? clusterGIS_empty_field : buffer + positions[offset];
+			dataset->lengths[offset] = lengths[offset];
+		}
+	}
+	MPI_Win_unlock_all(index);
+	MPI_Win_free(&index);
+	MPI_Comm_free(&node);
+	if(options != NULL && options->encode_column >= 0) {
+		clusterGIS_Encode_column(dataset, options->encode_column);
+	}
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_LOAD_TIME, start);
+
+	return dataset;
+}
+
+/* clusterGIS_Write_csv
+ *
+ * Writes a dataset out to a file as csv
+ *
+ * filename - file to write to
+ * dataset - dataset to write
+ */
+void clusterGIS_Write_csv(char* filename, clusterGIS_dataset* dataset) {
+	FILE* file;
+	int record;
+	int columns;
+	int i;
+	double start;
+
+	start = clusterGIS_Start_timer();
+	remove(filename);
+	file = fopen(filename, "w");
+
+	for(record = 0; record < dataset->size; record++) {
+		columns = clusterGIS_Get_columns(dataset, record);
+		for(i = 0; i < columns; i++) {
+			fputs(i == 0 ? "\"" : ",\"", file);
+			fwrite(clusterGIS_Get_field(dataset, record, i), 1, clusterGIS_Get_length(dataset, record, i), file);
+			fputc('"', file);
+		}
+		fputc('\n', file);
+	}
+
+	fclose(file);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_WRITE_TIME, start);
+}
+
+/* clusterGIS_Write_csv_distributed
+ *
+ * Writes a distributed dataset to disk using MPI-IO. Each task formats its
+ * records in memory, finds where they go in the file with a single
+ * MPI_Exscan of the sizes, and all tasks write with collective calls.
+ *
+ * comm - MPI communicator of the participants of the distributed dataset
+ * filename - path of the file to write to
+ * dataset - dataset to write
+ */
+void clusterGIS_Write_csv_distributed(MPI_Comm comm, char* filename, clusterGIS_dataset* dataset) {
+	long long size;
+	long long offset;
+	char* buffer;
+	MPI_File file;
+	int record;
+	int comm_rank;
+	int err;
+	double start;
+
+	start = clusterGIS_Start_timer();
+	MPI_Comm_rank(comm, &comm_rank);
+
+	/* Format the local part of the dataset */
+	size = 0;
+	for(record = 0; record < dataset->size; record++) {
+		size += clusterGIS_Csv_record_length(dataset, record);
+	}
+	buffer = malloc(size + 1);
+	offset = 0;
+	for(record = 0; record < dataset->size; record++) {
+		offset += clusterGIS_Format_csv_record(buffer + offset, dataset, record);
+	}
+
+	/* The local part starts after the parts of the lower ranks */
+	offset = 0;
+	MPI_Exscan(&size, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+	if(comm_rank == 0) {
+		offset = 0;
+	}
+
+	err = MPI_File_open(comm, filename, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &file);
+	if(err != MPI_SUCCESS) {
+		fprintf(stderr, "%d: Error opening file %s\n", comm_rank, filename);
+		MPI_Abort(comm, err);
+	}
+	MPI_File_set_size(file, 0);
+
+	clusterGIS_File_write_at_all(file, offset, buffer, size);
+
+	MPI_File_close(&file);
+	free(buffer);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_WRITE_TIME, start);
+}
+
+/* clusterGIS_File_write_at_all
+ *
+ * Collectively writes a buffer of any size. Whole blocks are written, then
+ * the remainder, so every task makes the same two collective calls however
+ * much it has.
+ *
+ * file - the open file
+ * offset - byte offset in the file to write at
+ * buffer - the bytes to write
+ * size - number of bytes to write
+ */
+void clusterGIS_File_write_at_all(MPI_File file, long long offset, char* buffer, long long size) {
+	MPI_Datatype block;
+	MPI_Status status;
+	long long blocks;
+	double start;
+
+	start = clusterGIS_Start_timer();
+	MPI_Type_contiguous(CLUSTERGIS_BUFFERSIZE, MPI_CHAR, &block);
+	MPI_Type_commit(&block);
+	blocks = size / (CLUSTERGIS_BUFFERSIZE);
+	MPI_File_write_at_all(file, offset, buffer, blocks, block, &status);
+	MPI_File_write_at_all(file, offset + blocks * (CLUSTERGIS_BUFFERSIZE), buffer + blocks * (CLUSTERGIS_BUFFERSIZE), size - blocks * (CLUSTERGIS_BUFFERSIZE), MPI_CHAR, &status);
+	MPI_Type_free(&block);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, start);
+}
+
+/* clusterGIS_File_read_at_all
+ *
+ * Collectively reads a buffer of any size, the counterpart of
+ * clusterGIS_File_write_at_all
+ *
+ * file - the open file
+ * offset - byte offset in the file to read from
+ * buffer - where the bytes are read to
+ * size - number of bytes to read
+ */
+void clusterGIS_File_read_at_all(MPI_File file, long long offset, char* buffer, long long size) {
+	MPI_Datatype block;
+	MPI_Status status;
+	long long blocks;
+	double start;
+
+	start = clusterGIS_Start_timer();
+	MPI_Type_contiguous(CLUSTERGIS_BUFFERSIZE, MPI_CHAR, &block);
+	MPI_Type_commit(&block);
+	blocks = size / (CLUSTERGIS_BUFFERSIZE);
+	MPI_File_read_at_all(file, offset, buffer, blocks, block, &status);
+	MPI_File_read_at_all(file, offset + blocks * (CLUSTERGIS_BUFFERSIZE), buffer + blocks * (CLUSTERGIS_BUFFERSIZE), size - blocks * (CLUSTERGIS_BUFFERSIZE), MPI_CHAR, &status);
+	MPI_Type_free(&block);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, start);
+}
+
+/* clusterGIS_Free_dataset
+ *
+ * Frees all memory associated with a dataset (all associated records, etc).
+ * For a dataset from clusterGIS_Load_csv_shared this is collective over the
+ * tasks of the node, which free the shared window together.
+ *
+ * dataset - the dataset to be freed
+ */
+void clusterGIS_Free_dataset(clusterGIS_dataset* dataset) {
+	clusterGIS_Clear_dataset(dataset);
+
+	free(dataset->offsets);
+	free(dataset->values);
+	free(dataset->lengths);
+	free(dataset->geometries);
+	free(dataset->pending);
+	free(dataset);
+}
+
+/* clusterGIS_Clear_dataset
+ *
+ * Removes all records from a dataset, keeping its arrays for reuse. If the
+ * dataset defers its geometries, see clusterGIS_Defer_wkt_geometries,
+ * records added later are deferred too. Like clusterGIS_Free_dataset, this
+ * is collective over the node for a dataset from clusterGIS_Load_csv_shared.
+ *
+ * dataset - the dataset to clear
+ */
+void clusterGIS_Clear_dataset(clusterGIS_dataset* dataset) {
+	int i;
+
+	clusterGIS_Free_index(dataset);
+	clusterGIS_Free_envelopes(dataset);
+	clusterGIS_Free_dictionary(dataset);
+	for(i = 0; i < dataset->size; i++) {
+		if(dataset->geometries[i] != NULL) {
+			GEOSGeom_destroy_r(clusterGIS_geos.handle, dataset->geometries[i]);
+		}
+	}
+	clusterGIS_Arena_release(&dataset->arena);
+	if(dataset->mapping != NULL) {
+		munmap(dataset->mapping, dataset->mapping_size);
+		dataset->mapping = NULL;
+		dataset->mapping_size = 0;
+	}
+	if(dataset->window != MPI_WIN_NULL) {
+		MPI_Win_unlock_all(dataset->window);
+		MPI_Win_free(&dataset->window);
+	}
+
+	free(dataset->views);
+	dataset->views = NULL;
+	dataset->data = NULL;
+	free(dataset->extents);
+	dataset->extents = NULL;
+	dataset->extents_count = 0;
+	dataset->size = 0;
+	dataset->offsets[0] = 0;
+}
+
+/* clusterGIS_Replace_dataset
+ *
+ * Replaces the contents of a dataset, e.g. with records received from other
+ * tasks, so callers keep using the same clusterGIS_dataset*
+ *
+ * dataset - the dataset whose contents are freed and replaced
+ * replacement - dataset holding the new contents, freed by this call
+ */
+void clusterGIS_Replace_dataset(clusterGIS_dataset* dataset, clusterGIS_dataset* replacement) {
+	clusterGIS_dataset old;
+
+	old = *dataset;
+	*dataset = *replacement;
+	*replacement = old;
+	clusterGIS_Free_dataset(replacement);
+}
+
+/* clusterGIS_Reserve
+ *
+ * Makes room in the dataset's arrays for one more record
+ *
+ * dataset - the dataset to grow
+ * values_needed - total number of fields the arrays must hold
+ */
+static void clusterGIS_Reserve(clusterGIS_dataset* dataset, size_t values_needed) {
+	size_t grown;
+
+	if(dataset->size == dataset->capacity) {
+		clusterGIS_Count(CLUSTERGIS_STAT_BYTES_ALLOCATED, (dataset->capacity == 0 ? 1024 : dataset->capacity) * (sizeof(size_t) + sizeof(GEOSGeometry*)));
+		dataset->capacity = dataset->capacity == 0 ? 1024 : dataset->capacity * 2;
+		dataset->offsets = realloc(dataset->offsets, (dataset->capacity + 1) * sizeof(size_t));
+		dataset->geometries = realloc(dataset->geometries, dataset->capacity * sizeof(GEOSGeometry*));
+		if(dataset->pending != NULL) {
+			dataset->pending = realloc(dataset->pending, dataset->capacity);
+		}
+		if(dataset->offsets == NULL || dataset->geometries == NULL) {
+			fprintf(stderr, "clusterGIS_Reserve: out of memory for %d records\n", dataset->capacity);
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		}
+	}
+
+	if(values_needed > dataset->values_capacity) {
+		grown = dataset->values_capacity;
+		if(dataset->values_capacity == 0) {
+			dataset->values_capacity = 4096;
+		}
+		while(dataset->values_capacity < values_needed) {
+			dataset->values_capacity *= 2;
+		}
+		clusterGIS_Count(CLUSTERGIS_STAT_BYTES_ALLOCATED, (dataset->values_capacity - grown) * (sizeof(char*) + sizeof(int)));
+		dataset->values = realloc(dataset->values, dataset->values_capacity * sizeof(char*));
+		dataset->lengths = realloc(dataset->lengths, dataset->values_capacity * sizeof(int));
+		if(dataset->values == NULL || dataset->lengths == NULL) {
+			fprintf(stderr, "clusterGIS_Reserve: out of memory for %lu fields\n", (unsigned long) dataset->values_capacity);
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		}
+	}
+}
+
+/* clusterGIS_Unlink_records
+ *
+ * Drops the record views, the index and the dictionary, which are
+ * invalidated when the dataset changes
+ *
+ * dataset - the dataset which changed
+ */
+static void clusterGIS_Unlink_records(clusterGIS_dataset* dataset) {
+	clusterGIS_Free_index(dataset);
+	clusterGIS_Free_envelopes(dataset);
+	clusterGIS_Free_dictionary(dataset);
+	free(dataset->views);
+	dataset->views = NULL;
+	dataset->data = NULL;
+}
+
+/* clusterGIS_Add_record
+ *
+ * Adds a record with room for the given number of fields to the end of a
+ * dataset; the caller sets the fields and their lengths
+ *
+ * dataset - the dataset to add the record to
+ * columns - number of fields of the record
+ *
+ * Returns the index of the new record
+ */
+int clusterGIS_Add_record(clusterGIS_dataset* dataset, int columns) {
+	int index;
+
+	clusterGIS_Unlink_records(dataset);
+	clusterGIS_Reserve(dataset, dataset->offsets[dataset->size] + columns);
+
+	index = dataset->size;
+	dataset->offsets[index + 1] = dataset->offsets[index] + columns;
+	dataset->geometries[index] = NULL;
+	if(dataset->pending != NULL) {
+		dataset->pending[index] = 1;
+	}
+	dataset->size++;
+
+	return index;
+}
+
+/* clusterGIS_Append_record
+ *
+ * Copies a record to the end of a dataset
+ *
+ * dataset - the dataset to add the record to
+ * record - the record to copy, it remains owned by the caller
+ *
+ * Returns the index of the new record
+ */
+int clusterGIS_Append_record(clusterGIS_dataset* dataset, clusterGIS_record* record) {
+	int index;
+	int i;
+
+	index = clusterGIS_Add_record(dataset, record->columns);
+	for(i = 0; i < record->columns; i++) {
+		clusterGIS_Get_length(dataset, index, i) = strlen(record->data[i]);
+		clusterGIS_Get_field(dataset, index, i) = clusterGIS_Arena_strndup(&dataset->arena, record->data[i], clusterGIS_Get_length(dataset, index, i));
+	}
+
+	return index;
+}
+
+/* clusterGIS_Append_record_from_csv
+ *
+ * Adds a record to the end of a dataset from the given csv formatted char*.
+ * The record is copied into the dataset once and split there, csv is not
+ * modified.
+ *
+ * dataset - the dataset to add the record to
+ * csv - csv formatted representation of record
+ * start - index of the start of the record in csv, returned with the end index
+ *
+ * Returns the index of the new record
+ */
+int clusterGIS_Append_record_from_csv(clusterGIS_dataset* dataset, char* csv, int* start) {
+	char* copy;
+	int end;
+	int i;
+
+	end = *start;
+	while(csv[end] != '\n') {
+		end++;
+	}
+
+	copy = clusterGIS_Arena_alloc(&dataset->arena, end - *start + 1);
+	memcpy(copy, csv + *start, end - *start + 1);
+	*start = end;
+
+	i = 0;
+	return clusterGIS_Parse_csv_record(dataset, copy, &i);
+}
+
+/* clusterGIS_Parse_csv_record
+ *
+ * Adds a record to the end of a dataset by splitting the csv formatted
+ * record in place. The fields point into csv, which must live as long as the
+ * dataset (e.g. a buffer retained by the dataset's arena).
+ *
+ * dataset - the dataset to add the record to
+ * csv - csv formatted representation of record, modified in place
+ * start - index of the start of the record in csv, returned with the end index
+ *
+ * Returns the index of the new record
+ */
+int clusterGIS_Parse_csv_record(clusterGIS_dataset* dataset, char* csv, int* start) {
+	int index;
+	int end;
+	int i;
+	size_t field;
+
+	clusterGIS_Unlink_records(dataset);
+
+	/* find end of record */
+	end = *start;
+	while(csv[end] != '\n') {
+		end++;
+	}
+
+	index = dataset->size;
+	field = dataset->offsets[index];
+	i = *start;
+	while(i < end) {
+		clusterGIS_Reserve(dataset, field + 1);
+		dataset->values[field] = clusterGIS_Split_csv_field(csv, &i, &dataset->lengths[field]);
+		field++;
+	}
+	clusterGIS_Reserve(dataset, field);
+	clusterGIS_Count(CLUSTERGIS_STAT_RECORDS_PARSED, 1);
+	clusterGIS_Count(CLUSTERGIS_STAT_FIELDS_PARSED, field - dataset->offsets[index]);
+	dataset->offsets[index + 1] = field;
+	dataset->geometries[index] = NULL;
+	if(dataset->pending != NULL) {
+		dataset->pending[index] = 1;
+	}
+	dataset->size++;
+
+	(*start) = end;
+	return index;
+}
+
+/* clusterGIS_Add_csv_records
+ *
+ * Adds the csv records of a load buffer to a dataset. Without tests in the
+ * options the records are split in place and the dataset retains the
+ * buffer. With tests or a projection each record is split and tested as
+ * the buffer is scanned, rejected records are dropped at once, and only the
+ * projected fields of the records kept are copied to the dataset's arena
+ * before the buffer is freed.
+ *
+ * dataset - the dataset to add the records to
+ * buffer - buffer from clusterGIS_Arena_create_buffer, the dataset owns it
+ *          afterwards
+ * start - index of the first record in buffer
+ * end - index after the '\n' of the last record in buffer
+ * options - load options, or NULL
+ */
+void clusterGIS_Add_csv_records(clusterGIS_dataset* dataset, char* buffer, int start, int end, clusterGIS_load_options* options) {
+	char* projected;
+	int last;
+	int record;
+	int first;
+	int column;
+	int i;
+
+	if(options == NULL || ((options->value_column < 0 || options->prefix == NULL) && options->window_column < 0 && options->columns == NULL)) {
+		/* Put the records into the dataset, their fields point into the retained buffer */
+		buffer = clusterGIS_Arena_retain_buffer(&dataset->arena, buffer, end);
+		i = start;
+		while (i < end) {
+			clusterGIS_Parse_csv_record(dataset, buffer, &i);
+			i++;
+		}
+		return;
+	}
+
+	projected = clusterGIS_Projected_columns(options, &last);
+	first = dataset->size;
+	i = start;
+	while(i < end) {
+		record = clusterGIS_Parse_csv_record(dataset, buffer, &i);
+		if(!clusterGIS_Load_test(dataset, record, options)) {
+			dataset->size--;
+		} else if(projected != NULL && clusterGIS_Get_columns(dataset, record) > last + 1) {
+			dataset->offsets[record + 1] = dataset->offsets[record] + last + 1;
+		}
+		i++;
+	}
+
+	/* the buffer is mostly rejected rows and columns, keep only what is needed */
+	for(record = first; record < dataset->size; record++) {
+		for(column = 0; column < clusterGIS_Get_columns(dataset, record); column++) {
+			if(projected != NULL && !projected[column]) {
+				clusterGIS_Get_field(dataset, record, column) = clusterGIS_empty_field;
+				clusterGIS_Get_length(dataset, record, column) = 0;
+			} else {
+				clusterGIS_Get_field(dataset, record, column) = clusterGIS_Arena_strndup(&dataset->arena, clusterGIS_Get_field(dataset, record, column), clusterGIS_Get_length(dataset, record, column));
+			}
+		}
+	}
+	clusterGIS_Arena_free_buffer(buffer);
+	free(projected);
+}
+
+/* clusterGIS_Load_test
+ *
+ * Returns whether a record just loaded passes the tests of load options
+ */
+static int clusterGIS_Load_test(clusterGIS_dataset* dataset, int record, clusterGIS_load_options* options) {
+	double envelope[4];
+	int columns = clusterGIS_Get_columns(dataset, record);
+	int length;
+
+	if(options->value_column >= 0 && options->prefix != NULL) {
+		length = strlen(options->prefix);
+		if(options->value_column >= columns || clusterGIS_Get_length(dataset, record, options->value_column) < length || memcmp(clusterGIS_Get_field(dataset, record, options->value_column), options->prefix, length) != 0) {
+			return 0;
+		}
+	}
+
+	if(options->window_column >= 0) {
+		if(options->window_column >= columns || !clusterGIS_Wkt_envelope(clusterGIS_Get_field(dataset, record, options->window_column), envelope)) {
+			return 0;
+		}
+		if(envelope[0] > options->window[2] || envelope[2] < options->window[0] || envelope[1] > options->window[3] || envelope[3] < options->window[1]) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* clusterGIS_Projected_columns
+ *
+ * Returns which columns load options keep, a flag per column up to the last
+ * one listed, or NULL when every column is kept
+ *
+ * options - the load options
+ * last - returned with the last column listed
+ */
+static char* clusterGIS_Projected_columns(clusterGIS_load_options* options, int* last) {
+	char* projected;
+	int i;
+
+	*last = -1;
+	if(options == NULL || options->columns == NULL) {
+		return NULL;
+	}
+	for(i = 0; i < options->columns_count; i++) {
+		if(options->columns[i] > *last) {
+			*last = options->columns[i];
+		}
+	}
+	projected = calloc(*last + 1, 1);
+	for(i = 0; i < options->columns_count; i++) {
+		if(options->columns[i] >= 0) {
+			projected[options->columns[i]] = 1;
+		}
+	}
+
+	return projected;
+}
+
+/* clusterGIS_Csv_record_length
+ *
+ * Returns the number of bytes clusterGIS_Format_csv_record writes for a record
+ *
+ * dataset - the dataset containing the record
+ * record - index of the record
+ */
+size_t clusterGIS_Csv_record_length(clusterGIS_dataset* dataset, int record) {
+	size_t length;
+	int columns;
+	int i;
+
+	columns = clusterGIS_Get_columns(dataset, record);
+	length = columns * 3;
+	for(i = 0; i < columns; i++) {
+		length += clusterGIS_Get_length(dataset, record, i);
+	}
+	if(columns == 0) {
+		length = 1;
+	}
+
+	return length;
+}
+
+/* clusterGIS_Format_csv_record
+ *
+ * Writes a record as a csv formatted line, every field quoted, in the same
+ * format as clusterGIS_Write_csv
+ *
+ * buffer - where to write the line, must have room for
+ *          clusterGIS_Csv_record_length bytes
+ * dataset - the dataset containing the record
+ * record - index of the record
+ *
+ * Returns the number of bytes written
+ */
+size_t clusterGIS_Format_csv_record(char* buffer, clusterGIS_dataset* dataset, int record) {
+	size_t position;
+	int columns;
+	int length;
+	int i;
+
+	position = 0;
+	columns = clusterGIS_Get_columns(dataset, record);
+	for(i = 0; i < columns; i++) {
+		if(i > 0) {
+			buffer[position++] = ',';
+		}
+		buffer[position++] = '"';
+		length = clusterGIS_Get_length(dataset, record, i);
+		memcpy(buffer + position, clusterGIS_Get_field(dataset, record, i), length);
+		position += length;
+		buffer[position++] = '"';
+	}
+	buffer[position++] = '\n';
+
+	return position;
+}
+
+/* clusterGIS_Set_field
+ *
+ * Replaces a field of a record. The value is copied into the dataset, the
+ * loaded field it replaces is left untouched. Setting a field of the
+ * dictionary encoded column drops the dictionary.
+ *
+ * dataset - the dataset containing the record
+ * record - index of the record
+ * column - column of the field to replace
+ * value - the new value
+ */
+void clusterGIS_Set_field(clusterGIS_dataset* dataset, int record, int column, char* value) {
+	int length;
+
+	if(column == dataset->dictionary.column) {
+		clusterGIS_Free_dictionary(dataset);
+	}
+
+	length = strlen(value);
+	clusterGIS_Get_field(dataset, record, column) = clusterGIS_Arena_strndup(&dataset->arena, value, length);
+	clusterGIS_Get_length(dataset, record, column) = length;
+}
+
+/* clusterGIS_Keep_records
+ *
+ * Removes records from a dataset in place, keeping the order of the rest
+ *
+ * dataset - the dataset to compact
+ * keep - one entry per record, non-zero for records to keep
+ *
+ * Returns the number of records kept
+ */
+int clusterGIS_Keep_records(clusterGIS_dataset* dataset, char* keep) {
+	clusterGIS_envelopes envelopes;
+	clusterGIS_dictionary dictionary;
+	int record;
+	int kept;
+	int columns;
+	size_t values;
+	int i;
+
+	/* cached envelopes and the dictionary are kept in step with the records */
+	clusterGIS_Free_index(dataset);
+	envelopes = dataset->envelopes;
+	dataset->envelopes.xmin = NULL;
+	dictionary = dataset->dictionary;
+	dataset->dictionary.column = -1;
+	clusterGIS_Unlink_records(dataset);
+
+	kept = 0;
+	values = 0;
+	for(record = 0; record < dataset->size; record++) {
+		if(!keep[record]) {
+			if(dataset->geometries[record] != NULL) {
+				GEOSGeom_destroy_r(clusterGIS_geos.handle, dataset->geometries[record]);
+			}
+			continue;
+		}
+
+		columns = clusterGIS_Get_columns(dataset, record);
+		if(kept != record) {
+			for(i = 0; i < columns; i++) {
+				dataset->values[values + i] = dataset->values[dataset->offsets[record] + i];
+				dataset->lengths[values + i] = dataset->lengths[dataset->offsets[record] + i];
+			}
+			dataset->geometries[kept] = dataset->geometries[record];
+			if(dataset->pending != NULL) {
+				dataset->pending[kept] = dataset->pending[record];
+			}
+			if(envelopes.xmin != NULL) {
+				envelopes.xmin[kept] = envelopes.xmin[record];
+				envelopes.ymin[kept] = envelopes.ymin[record];
+				envelopes.xmax[kept] = envelopes.xmax[record];
+				envelopes.ymax[kept] = envelopes.ymax[record];
+			}
+			if(dictionary.column >= 0) {
+				dictionary.codes[kept] = dictionary.codes[record];
+			}
+		}
+		dataset->offsets[kept] = values;
+		values += columns;
+		kept++;
+	}
+	dataset->offsets[kept] = values;
+	dataset->size = kept;
+	if(envelopes.xmin != NULL) {
+		envelopes.size = kept;
+		dataset->envelopes = envelopes;
+	}
+	if(dictionary.column >= 0) {
+		dataset->dictionary = dictionary;
+		clusterGIS_Group_codes(dataset);
+	}
+
+	return kept;
+}
+
+/* clusterGIS_Order_records
+ *
+ * Reorders the records of a dataset in place, keeping the dictionary in
+ * step with them
+ *
+ * dataset - the dataset to reorder
+ * order - the records in their new order, every record once
+ */
+void clusterGIS_Order_records(clusterGIS_dataset* dataset, int* order) {
+	clusterGIS_dictionary dictionary;
+	size_t* offsets;
+	char** values;
+	int* lengths;
+	GEOSGeometry** geometries;
+	char* pending;
+	int* codes;
+	int columns;
+	int record;
+	int i;
+	int j;
+
+	if(dataset->size == 0) {
+		return;
+	}
+
+	clusterGIS_Free_index(dataset);
+	dictionary = dataset->dictionary;
+	dataset->dictionary.column = -1;
+	clusterGIS_Unlink_records(dataset);
+
+	offsets = malloc((dataset->capacity + 1) * sizeof(size_t));
+	values = malloc(dataset->values_capacity * sizeof(char*));
+	lengths = malloc(dataset->values_capacity * sizeof(int));
+	geometries = malloc(dataset->capacity * sizeof(GEOSGeometry*));
+	pending = dataset->pending != NULL ? malloc(dataset->capacity) : NULL;
+	codes = dictionary.column >= 0 ? malloc(dataset->size * sizeof(int)) : NULL;
+	if(offsets == NULL || values == NULL || lengths == NULL || geometries == NULL) {
+		fprintf(stderr, "clusterGIS_Order_records: out of memory for %d records\n", dataset->size);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	offsets[0] = 0;
+	for(i = 0; i < dataset->size; i++) {
+		record = order[i];
+		columns = clusterGIS_Get_columns(dataset, record);
+		for(j = 0; j < columns; j++) {
+			values[offsets[i] + j] = clusterGIS_Get_field(dataset, record, j);
+			lengths[offsets[i] + j] = clusterGIS_Get_length(dataset, record, j);
+		}
+		offsets[i + 1] = offsets[i] + columns;
+		geometries[i] = dataset->geometries[record];
+		if(pending != NULL) {
+			pending[i] = dataset->pending[record];
+		}
+		if(codes != NULL) {
+			codes[i] = dictionary.codes[record];
+		}
+	}
+
+	free(dataset->offsets);
+	free(dataset->values);
+	free(dataset->lengths);
+	free(dataset->geometries);
+	free(dataset->pending);
+	dataset->offsets = offsets;
+	dataset->values = values;
+	dataset->lengths = lengths;
+	dataset->geometries = geometries;
+	dataset->pending = pending;
+	if(codes != NULL) {
+		free(dictionary.codes);
+		dictionary.codes = codes;
+		dataset->dictionary = dictionary;
+		clusterGIS_Group_codes(dataset);
+	}
+}
+
+/* clusterGIS_Link_records
+ *
+ * Links a clusterGIS_record view of every record into dataset->data, for
+ * code that walks the dataset as a list. The views share the dataset's
+ * fields and stay valid until the dataset is next changed. They must not be
+ * passed to clusterGIS_Free_record.
+ *
+ * dataset - the dataset to link
+ *
+ * Returns the first record, which is also stored in dataset->data
+ */
+clusterGIS_record* clusterGIS_Link_records(clusterGIS_dataset* dataset) {
+	int i;
+
+	clusterGIS_Materialize_geometries(dataset);
+	clusterGIS_Unlink_records(dataset);
+	if(dataset->size == 0) {
+		return NULL;
+	}
+
+	dataset->views = malloc(dataset->size * sizeof(clusterGIS_record));
+	for(i = 0; i < dataset->size; i++) {
+		dataset->views[i].data = &clusterGIS_Get_field(dataset, i, 0);
+		dataset->views[i].columns = clusterGIS_Get_columns(dataset, i);
+		dataset->views[i].geometry = dataset->geometries[i];
+		dataset->views[i].next = &dataset->views[i + 1];
+	}
+	dataset->views[dataset->size - 1].next = NULL;
+	dataset->data = dataset->views;
+
+	return dataset->data;
+}
+
+/* dictionary operations */
+
+/* clusterGIS_Encode_column
+ *
+ * Dictionary encodes a column: each distinct value gets a code, local to
+ * this task, and the records are grouped by code, see
+ * clusterGIS_dictionary. Comparing codes replaces comparing strings, and
+ * clusterGIS_Build_index then indexes every group on its own. Records
+ * without the column have the value "". Any previous dictionary and the
+ * index are dropped.
+ *
+ * dataset - the dataset to encode
+ * column - the column to encode
+ */
+void clusterGIS_Encode_column(clusterGIS_dataset* dataset, int column) {
+	clusterGIS_dictionary* dictionary = &dataset->dictionary;
+	char*** sorted;
+	int capacity;
+	int record;
+	int slot;
+	int code;
+	char* value;
+	int length;
+	int i;
+
+	clusterGIS_Free_index(dataset);
+	clusterGIS_Free_dictionary(dataset);
+
+	dictionary->column = column;
+	dictionary->size = 0;
+	dictionary->codes = malloc((dataset->size + 1) * sizeof(int));
+	dictionary->slots_count = 64;
+	dictionary->slots = malloc(dictionary->slots_count * sizeof(int));
+	for(i = 0; i < dictionary->slots_count; i++) {
+		dictionary->slots[i] = -1;
+	}
+	capacity = 16;
+	dictionary->values = malloc(capacity * sizeof(char*));
+
+	for(record = 0; record < dataset->size; record++) {
+		if(column < clusterGIS_Get_columns(dataset, record)) {
+			value = clusterGIS_Get_field(dataset, record, column);
+			length = clusterGIS_Get_length(dataset, record, column);
+		} else {
+			value = clusterGIS_empty_field;
+			length = 0;
+		}
+
+		slot = clusterGIS_Find_slot(dictionary, value, length);
+		code = dictionary->slots[slot];
+		if(code < 0) {
+			if(dictionary->size == capacity) {
+				capacity *= 2;
+				dictionary->values = realloc(dictionary->values, capacity * sizeof(char*));
+			}
+			code = dictionary->size++;
+			dictionary->values[code] = strndup(value, length);
+			dictionary->slots[slot] = code;
+
+			/* keep the table at most half full */
+			if(dictionary->size * 2 > dictionary->slots_count) {
+				free(dictionary->slots);
+				dictionary->slots_count *= 2;
+				dictionary->slots = malloc(dictionary->slots_count * sizeof(int));
+				for(i = 0; i < dictionary->slots_count; i++) {
+					dictionary->slots[i] = -1;
+				}
+				for(i = 0; i < dictionary->size; i++) {
+					dictionary->slots[clusterGIS_Find_slot(dictionary, dictionary->values[i], strlen(dictionary->values[i]))] = i;
+				}
+			}
+		}
+		dictionary->codes[record] = code;
+	}
+	clusterGIS_Count(CLUSTERGIS_STAT_BYTES_ALLOCATED, (dataset->size + dictionary->slots_count) * sizeof(int) + capacity * sizeof(char*));
+
+	/* sort pointers to the values, their positions in values are the codes */
+	sorted = malloc((dictionary->size + 1) * sizeof(char**));
+	for(code = 0; code < dictionary->size; code++) {
+		sorted[code] = &dictionary->values[code];
+	}
+	qsort(sorted, dictionary->size, sizeof(char**), clusterGIS_Compare_values);
+	dictionary->sorted = malloc((dictionary->size + 1) * sizeof(int));
+	for(code = 0; code < dictionary->size; code++) {
+		dictionary->sorted[code] = sorted[code] - dictionary->values;
 	}
-	
-	free(buffer);
-	MPI_File_close(&file);
+	free(sorted);
 
-	return dataset;
+	clusterGIS_Group_codes(dataset);
 }
 
-/* clusterGIS_Load_csv_replicated
+static int clusterGIS_Compare_values(const void* a, const void* b) {
+	return strcmp(**(char***) a, **(char***) b);
+}
+
+/* clusterGIS_Lookup_code
  *
- * Loads an entire copy of a csv data source on each task included in comm
+ * Finds the code of a value of the dictionary encoded column
  *
- * comm - MPI communicator of which all members will get a copy of this dataset
- * filename - path to the csv formatted dataset
+ * dataset - an encoded dataset
+ * value - the value to look up
  *
- * returns a pointer to the dataset
+ * Returns the code, or -1 when no record has the value
  */
-clusterGIS_dataset* clusterGIS_Load_csv_replicated(MPI_Comm comm, char* filename) {
-	MPI_File file;
-	int err;
-	char* buffer;
-	int buffersize = 2*1024*1024;
-	MPI_Status status;
-	clusterGIS_record** record;
-	MPI_Offset offset;
-	int count;
-	int last_full_record_end;
-	MPI_Offset filesize;
-	int i;
-	clusterGIS_dataset* dataset;
-	int comm_rank;
+int clusterGIS_Lookup_code(clusterGIS_dataset* dataset, char* value) {
+	if(dataset->dictionary.column < 0) {
+		fprintf(stderr, "clusterGIS_Lookup_code: the dataset has no dictionary, see clusterGIS_Encode_column\n");
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
 
-	MPI_Comm_rank(comm, &comm_rank);
+	return dataset->dictionary.slots[clusterGIS_Find_slot(&dataset->dictionary, value, strlen(value))];
+}
 
-	err = MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
-	if(err != MPI_SUCCESS) {
-		fprintf(stderr, "%d: Error opening file %s\n", comm_rank, filename);
-		MPI_Abort(comm, err);
+/* clusterGIS_Free_dictionary
+ *
+ * Frees the dictionary of a dataset, if it has one, and the index built
+ * over its groups
+ *
+ * dataset - the dataset whose dictionary is freed
+ */
+void clusterGIS_Free_dictionary(clusterGIS_dataset* dataset) {
+	clusterGIS_dictionary* dictionary = &dataset->dictionary;
+	int i;
+
+	if(dictionary->column < 0) {
+		return;
+	}
+	if(dictionary->indexes != NULL) {
+		clusterGIS_Free_index(dataset);
 	}
 
-	buffer = (char*) malloc(buffersize);
-	MPI_File_get_size(file, &filesize);
-	offset = 0;
-	dataset = (clusterGIS_dataset*) malloc(sizeof(clusterGIS_dataset));
-	record = &dataset->data;
+	for(i = 0; i < dictionary->size; i++) {
+		free(dictionary->values[i]);
+	}
+	free(dictionary->values);
+	free(dictionary->codes);
+	free(dictionary->starts);
+	free(dictionary->records);
+	free(dictionary->slots);
+	free(dictionary->sorted);
+	dictionary->column = -1;
+	dictionary->size = 0;
+	dictionary->values = NULL;
+	dictionary->codes = NULL;
+	dictionary->starts = NULL;
+	dictionary->records = NULL;
+	dictionary->slots = NULL;
+	dictionary->slots_count = 0;
+	dictionary->sorted = NULL;
+}
 
-	while(offset < filesize) {
-		MPI_File_read_at_all(file, offset, buffer, buffersize, MPI_CHAR, &status);
-		MPI_Get_count(&status, MPI_CHAR, &count);
-	
-		/* find where the last full record ends */
-		last_full_record_end = count - 1;
-		while(buffer[last_full_record_end] != '\n' && last_full_record_end >= 0) {
-			last_full_record_end--;
-		}
-		if(last_full_record_end < 0) {
-			fprintf(stderr, "%d: Error in clusterGIS_Load_data_replicated: buffersize is too small, %d\n", comm_rank, count);
-			MPI_Abort(comm, 1);
+/* clusterGIS_Find_slot
+ *
+ * Probes the hash table of a dictionary for a value
+ *
+ * dictionary - the dictionary to search
+ * value - the value, which need not be null terminated
+ * length - length of the value
+ *
+ * Returns the slot holding the value's code, or the empty slot where it
+ * belongs
+ */
+static int clusterGIS_Find_slot(clusterGIS_dictionary* dictionary, const char* value, int length) {
+	int slot;
+	int code;
+
+	slot = clusterGIS_Hash(value, length) & (dictionary->slots_count - 1);
+	while((code = dictionary->slots[slot]) >= 0) {
+		if(strncmp(dictionary->values[code], value, length) == 0 && dictionary->values[code][length] == '\0') {
+			break;
 		}
+		slot = (slot + 1) & (dictionary->slots_count - 1);
+	}
 
-		/* Put the records into the dataset */
-		i = 0;
-		while (i < last_full_record_end) {
-			(*record) = clusterGIS_Create_record_from_csv(buffer, &i);
-			(*record)->next = NULL;
-			record = &(*record)->next;
-			i++;
-		}
+	return slot;
+}
 
-		offset = offset + last_full_record_end + 1;
+/* clusterGIS_Group_codes
+ *
+ * Sorts the records of an encoded dataset into one group per code, keeping
+ * their order within each group
+ *
+ * dataset - the encoded dataset
+ */
+static void clusterGIS_Group_codes(clusterGIS_dataset* dataset) {
+	clusterGIS_dictionary* dictionary = &dataset->dictionary;
+	int* next;
+	int record;
+	int code;
+
+	free(dictionary->starts);
+	free(dictionary->records);
+	dictionary->starts = calloc(dictionary->size + 1, sizeof(int));
+	dictionary->records = malloc((dataset->size + 1) * sizeof(int));
+	next = malloc((dictionary->size + 1) * sizeof(int));
+
+	for(record = 0; record < dataset->size; record++) {
+		dictionary->starts[dictionary->codes[record] + 1]++;
+	}
+	for(code = 0; code < dictionary->size; code++) {
+		dictionary->starts[code + 1] += dictionary->starts[code];
+		next[code] = dictionary->starts[code];
+	}
+	for(record = 0; record < dataset->size; record++) {
+		dictionary->records[next[dictionary->codes[record]]++] = record;
 	}
 
-	free(buffer);
-	MPI_File_close(&file);
-	
-	return dataset;
+	free(next);
 }
 
-/* clusterGIS_Write_csv
+/* clusterGIS_Hash
  *
- * Writes a dataset out to a file as csv
+ * FNV-1a hash of a string
  *
- * filename - file to write to
- * dataset - dataset to write
+ * value - the string, which need not be null terminated
+ * length - length of the string
  */
-void clusterGIS_Write_csv(char* filename, clusterGIS_dataset* dataset) {
-	FILE* file;
-	clusterGIS_record* record;
+unsigned int clusterGIS_Hash(const char* value, int length) {
+	unsigned int hash = 2166136261u;
 	int i;
 
-	remove(filename);
-	file = fopen(filename, "w");
+	for(i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char) value[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+/* arena operations */
+
+/* clusterGIS_Arena_alloc
+ *
+ * Allocates memory which lives until the arena is released
+ *
+ * arena - the arena to allocate from
+ * size - number of bytes needed
+ *
+ * Returns a pointer to the memory, aligned for any type
+ */
+void* clusterGIS_Arena_alloc(clusterGIS_arena* arena, size_t size) {
+	clusterGIS_arena_block* block;
+	size_t blocksize;
+
+	size = (size + 15) & ~((size_t) 15);
+
+	block = arena->blocks;
+	if(block == NULL || block->size - block->used < size) {
+		blocksize = CLUSTERGIS_ARENA_BLOCKSIZE;
+		if(size > blocksize - CLUSTERGIS_ARENA_HEADER) {
+			blocksize = size + CLUSTERGIS_ARENA_HEADER;
+		}
 
-	record = dataset->data;
-	while(record != NULL) {
-		fprintf(file, "\"%s\"", record->data[0]);
-		for(i = 1; i < record->columns; i++) {
-			fprintf(file, ",\"%s\"", record->data[i]);
+		block = malloc(blocksize);
+		if(block == NULL) {
+			fprintf(stderr, "clusterGIS_Arena_alloc: out of memory for %lu bytes\n", (unsigned long) blocksize);
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		}
+		block->size = blocksize;
+		block->used = CLUSTERGIS_ARENA_HEADER;
+		arena->allocated += blocksize;
+		clusterGIS_Count(CLUSTERGIS_STAT_BYTES_ALLOCATED, blocksize);
+
+		/* keep the fuller block at the head when a large allocation gets its own block */
+		if(arena->blocks != NULL && blocksize > CLUSTERGIS_ARENA_BLOCKSIZE) {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		} else {
+			block->next = arena->blocks;
+			arena->blocks = block;
 		}
-		fprintf(file, "\n");
-		record = record->next;
 	}
 
-	fclose(file);
+	block->used += size;
+	return (char*) block + block->used - size;
 }
 
-/* clusterGIS_Write_csv_distributed
+/* clusterGIS_Arena_strndup
  *
- * Writes a distributed dataset to disk using MPI-IO
+ * Copies a string into an arena
  *
- * comm - MPI communicator of the participants of the distributed dataset
- * filename - path of the file to write to
- * dataset - dataset to write
+ * arena - the arena to copy into
+ * string - the characters to copy
+ * length - number of characters to copy, a '\0' is added after them
+ *
+ * Returns the copy
  */
-void clusterGIS_Write_csv_distributed(MPI_Comm comm, char* filename, clusterGIS_dataset* dataset) {
-	char* filename_part;
-	MPI_Offset filesize;
-	MPI_Offset offset;
-	int i;
-	int tmp;
-	FILE* file_part;
-	char* buffer;
-	int buffersize=1024*1024;
-	MPI_File file;
-	struct stat *file_part_stat;
-	int size;
-	MPI_Status status;
-	int comm_rank;
-	int comm_size;
+char* clusterGIS_Arena_strndup(clusterGIS_arena* arena, const char* string, size_t length) {
+	char* copy;
 
-	MPI_Comm_rank(comm, &comm_rank);
-	MPI_Comm_size(comm, &comm_size);
+	copy = clusterGIS_Arena_alloc(arena, length + 1);
+	memcpy(copy, string, length);
+	copy[length] = '\0';
 
-	/* Write local part of dataset to individual files */
-	filename_part = (char*) malloc(strlen(filename) + 5);
-	sprintf(filename_part, "%s.%d", filename, comm_rank);
-	clusterGIS_Write_csv(filename_part, dataset);
+	return copy;
+}
 
-	/* Figure out offset by talking with other tasks */
-	file_part_stat = malloc(sizeof(struct stat));
-	stat(filename_part, file_part_stat);
-	filesize = (int) file_part_stat->st_size;
-	free(file_part_stat);
+/* clusterGIS_Arena_create_buffer
+ *
+ * Allocates a buffer which can later be handed to an arena with
+ * clusterGIS_Arena_retain_buffer
+ *
+ * size - size of the buffer in bytes
+ *
+ * Returns the buffer
+ */
+char* clusterGIS_Arena_create_buffer(size_t size) {
+	clusterGIS_arena_block* block;
 
-	offset = 0;
-	for(i = 0; i < comm_size; i++) {
-		tmp = filesize;
-		MPI_Bcast(&tmp, 1, MPI_INT, i, comm);
-		if (i < comm_rank) {
-			offset += tmp;
-		}
+	block = malloc(CLUSTERGIS_ARENA_HEADER + size);
+	if(block == NULL) {
+		fprintf(stderr, "clusterGIS_Arena_create_buffer: out of memory for %lu bytes\n", (unsigned long) size);
+		MPI_Abort(MPI_COMM_WORLD, 1);
 	}
+	block->size = CLUSTERGIS_ARENA_HEADER + size;
+	block->used = block->size;
+	block->next = NULL;
+	clusterGIS_Count(CLUSTERGIS_STAT_BYTES_ALLOCATED, block->size);
 
-	/* Write local parts back together into a single large file */
-	file_part = fopen(filename_part, "r");
-	remove(filename);
-	MPI_File_open(comm, filename, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &file);
-	buffer = (char*) malloc(buffersize);
+	return (char*) block + CLUSTERGIS_ARENA_HEADER;
+}
 
-	size = fread(buffer, 1, buffersize, file_part);
-	while(size != 0) {
-		MPI_File_write_at(file, offset, buffer, size, MPI_CHAR, &status); 
-		offset += size;
-		size = fread(buffer, 1, buffersize, file_part);
+/* clusterGIS_Arena_retain_buffer
+ *
+ * Makes a buffer from clusterGIS_Arena_create_buffer part of an arena, so
+ * it lives until the arena is released. The buffer is shrunk to size first
+ * and may move.
+ *
+ * arena - the arena which will own the buffer
+ * buffer - the buffer to retain
+ * size - number of bytes at the start of the buffer to keep
+ *
+ * Returns the retained buffer
+ */
+char* clusterGIS_Arena_retain_buffer(clusterGIS_arena* arena, char* buffer, size_t size) {
+	clusterGIS_arena_block* block;
+
+	block = (clusterGIS_arena_block*) (buffer - CLUSTERGIS_ARENA_HEADER);
+	if(CLUSTERGIS_ARENA_HEADER + size < block->size) {
+		block = realloc(block, CLUSTERGIS_ARENA_HEADER + size);
+		block->size = CLUSTERGIS_ARENA_HEADER + size;
+		block->used = block->size;
+	}
+	arena->allocated += block->size;
+
+	/* the head block is the one allocations are made from, keep it there */
+	if(arena->blocks != NULL) {
+		block->next = arena->blocks->next;
+		arena->blocks->next = block;
+	} else {
+		block->next = NULL;
+		arena->blocks = block;
 	}
-	free(buffer);
-	fclose(file_part);
-	remove(filename_part);
-	MPI_File_close(&file);
 
-	free(filename_part);
+	return (char*) block + CLUSTERGIS_ARENA_HEADER;
 }
 
-/* clusterGIS_Free_dataset
+/* clusterGIS_Arena_free_buffer
  *
- * Frees all memory associated with a dataset (all associated records, etc)
+ * Frees a buffer from clusterGIS_Arena_create_buffer which was not retained
  *
- * dataset - the dataset to be freed
+ * buffer - the buffer to free
  */
-void clusterGIS_Free_dataset(clusterGIS_dataset* dataset) {
-	clusterGIS_record* head;
-	clusterGIS_record* current;
+void clusterGIS_Arena_free_buffer(char* buffer) {
+	free(buffer - CLUSTERGIS_ARENA_HEADER);
+}
 
-	head = dataset->data;
-	current = head;
-	while(current != NULL) {
-		head = current->next;
-		clusterGIS_Free_record(current);
-		current = head;
+/* clusterGIS_Arena_grow_buffer
+ *
+ * Grows a buffer from clusterGIS_Arena_create_buffer which was not retained
+ *
+ * buffer - the buffer to grow
+ * size - the new size of the buffer in bytes
+ *
+ * Returns the buffer, which may have moved
+ */
+char* clusterGIS_Arena_grow_buffer(char* buffer, size_t size) {
+	clusterGIS_arena_block* block;
+
+	block = (clusterGIS_arena_block*) (buffer - CLUSTERGIS_ARENA_HEADER);
+	clusterGIS_Count(CLUSTERGIS_STAT_BYTES_ALLOCATED, CLUSTERGIS_ARENA_HEADER + size - block->size);
+	block = realloc(buffer - CLUSTERGIS_ARENA_HEADER, CLUSTERGIS_ARENA_HEADER + size);
+	if(block == NULL) {
+		fprintf(stderr, "clusterGIS_Arena_grow_buffer: out of memory for %lu bytes\n", (unsigned long) size);
+		MPI_Abort(MPI_COMM_WORLD, 1);
 	}
+	block->size = CLUSTERGIS_ARENA_HEADER + size;
+	block->used = block->size;
 
-	free(dataset);
+	return (char*) block + CLUSTERGIS_ARENA_HEADER;
+}
+
+/* clusterGIS_Arena_release
+ *
+ * Frees everything allocated from an arena
+ *
+ * arena - the arena to release
+ */
+void clusterGIS_Arena_release(clusterGIS_arena* arena) {
+	clusterGIS_arena_block* block;
+
+	while(arena->blocks != NULL) {
+		block = arena->blocks;
+		arena->blocks = block->next;
+		free(block);
+	}
+	arena->allocated = 0;
 }
 
 /* clusterGIS_Create_record_from_csv
  * 
- * Creates a record from the given csv formatted char*
+ * Creates a record from the given csv formatted char*. The record and its
+ * fields are a single allocation.
  *
  * csv - csv formatted representation of record
  * start - index of the start of the record in csv, returned with the end index
@@ -349,85 +2089,84 @@ void clusterGIS_Free_dataset(clusterGIS_dataset* dataset) {
  */
 clusterGIS_record* clusterGIS_Create_record_from_csv(char* csv, int* start) {
 	int end = *start;
-	int field_end;
-	int field_count;
-	int field_start;
+	int max_fields;
+	int length;
+	int field_length;
 	int i;
-	int j;
+	char* copy;
 	clusterGIS_record* record;
 
-	struct item {
-		char* data;
-		int len;
-		struct item* next;
-	};
-	struct item* head;
-	struct item* current;
-
-	/* find end of record */
+	/* find end of record, every field but the last ends with a comma */
+	max_fields = 1;
 	while(csv[end] != '\n') {
-		end++;
-	}
-	
-	/* Pull the fields out of the record. Assumes fields are comma delimited. Quotes surround fields with commas or quotes (escaped in the field) */
-	i = *start;
-	field_count = 0;
-	head = (struct item*) malloc(sizeof(struct item));
-	current = head;
-	current->next = NULL;
-	while(i < end) {
-		/* get the start and stop indexes of the field */
-		if(csv[i] == '"') {
-			/* escaped field */
-			i++;
-			field_start = i;
-			while (csv[i] != '"' && csv[i-1] != '\\') {
-				i++;
-			}
-			field_end = i;
-			i++; /* moves to the , or \n that follows the " */
-		} else {
-			/* non escaped field */
-			field_start = i;
-			while(csv[i] != ',' && csv[i] != '\n') {
-				i++;
-			}
-			field_end = i;
-		}
-
-		/* add field to the linked list and move to the next field */
-		current->data = (char*) malloc(field_end - field_start + 1);
-		for(j = 0; j < field_end - field_start; j++) {
-			current->data[j] = csv[field_start + j];
+		if(csv[end] == ',') {
+			max_fields++;
 		}
-		current->data[j] = '\0';
-
-		current->next = (struct item*) malloc(sizeof(struct item));
-		current = current->next;
-		current->next = NULL;
-		field_count++;
-		i++;
+		end++;
 	}
+	length = end - *start + 1;
 
-	/* Convert the linked list to an array of strings */
-	current = head;
-	i = 0;
-	record = (clusterGIS_record*) malloc(sizeof(clusterGIS_record));
-	record->data = malloc(field_count * sizeof(char*));
-	record->columns = field_count;
+	record = (clusterGIS_record*) malloc(sizeof(clusterGIS_record) + max_fields * sizeof(char*) + length);
+	record->data = (char**) (record + 1);
+	record->columns = 0;
 	record->next = NULL;
 	record->geometry = NULL;
-	for(i = 0; i < field_count; i++) {
-		record->data[i] = current->data;
-		head = current->next;
-		free(current);
-		current = head;
+
+	/* split a copy of the record in place */
+	copy = (char*) (record->data + max_fields);
+	memcpy(copy, csv + *start, length);
+	i = 0;
+	while(i < length - 1) {
+		record->data[record->columns] = clusterGIS_Split_csv_field(copy, &i, &field_length);
+		record->columns++;
 	}
 
 	(*start) = end;
 	return record;
 }
 
+/* clusterGIS_Split_csv_field
+ *
+ * Splits a field off a csv formatted record in place by terminating it.
+ * Assumes fields are comma delimited. Quotes surround fields with commas or
+ * quotes (escaped in the field)
+ *
+ * csv - csv formatted record, modified in place
+ * i - index of the start of the field, returned with the start of the next field
+ * length - returned with the length of the field
+ *
+ * Returns the field
+ */
+static char* clusterGIS_Split_csv_field(char* csv, int* i, int* length) {
+	int field_start;
+	int field_end;
+
+	if(csv[*i] == '"') {
+		/* escaped field */
+		(*i)++;
+		field_start = *i;
+		while(csv[*i] != '\n' && (csv[*i] != '"' || csv[*i - 1] == '\\')) {
+			(*i)++;
+		}
+		field_end = *i;
+		if(csv[*i] == '"') {
+			(*i)++; /* moves to the , or \n that follows the " */
+		}
+	} else {
+		/* non escaped field */
+		field_start = *i;
+		while(csv[*i] != ',' && csv[*i] != '\n') {
+			(*i)++;
+		}
+		field_end = *i;
+	}
+	(*i)++;
+
+	csv[field_end] = '\0';
+	*length = field_end - field_start;
+	return csv + field_start;
+}
+
 /* clusterGIS_Free_record
  *
  * Frees all memory associated with a record
@@ -435,10 +2174,7 @@ clusterGIS_record* clusterGIS_Create_record_from_csv(char* csv, int* start) {
  * record - the record to free
  */
 void clusterGIS_Free_record(clusterGIS_record* record) {
-	if(record != NULL) {
-		free(record->data);
-		free(record);
-	}
+	free(record);
 }
 
 /* MPI operations */
@@ -521,6 +2257,66 @@ MPI_Comm clusterGIS_Create_strided_communicator(MPI_Comm comm, int stride) {
 	return new_comm;
 }
 
+/* clusterGIS_Create_context
+ *
+ * Creates a reentrant GEOS context and the readers and writers used with it,
+ * so they are not created for every geometry
+ *
+ * context - the context to initialize
+ */
+void clusterGIS_Create_context(clusterGIS_context* context) {
+	context->handle = GEOS_init_r();
+	context->thread = 0;
+	context->wkt_reader = GEOSWKTReader_create_r(context->handle);
+	context->wkt_writer = GEOSWKTWriter_create_r(context->handle);
+	context->wkb_reader = GEOSWKBReader_create_r(context->handle);
+	context->wkb_writer = GEOSWKBWriter_create_r(context->handle);
+}
+
+/* clusterGIS_Free_context
+ *
+ * Frees a GEOS context and its readers and writers
+ *
+ * context - the context to free
+ */
+void clusterGIS_Free_context(clusterGIS_context* context) {
+	GEOSWKTReader_destroy_r(context->handle, context->wkt_reader);
+	GEOSWKTWriter_destroy_r(context->handle, context->wkt_writer);
+	GEOSWKBReader_destroy_r(context->handle, context->wkb_reader);
+	GEOSWKBWriter_destroy_r(context->handle, context->wkb_writer);
+	GEOS_finish_r(context->handle);
+}
+
+/* clusterGIS_Get_envelope
+ *
+ * Gets the envelope of a record's geometry
+ *
+ * dataset - the dataset containing the record
+ * record - index of the record
+ * envelope - returned with xmin, ymin, xmax, ymax, or with an empty
+ *            envelope of DBL_MAX, DBL_MAX, -DBL_MAX, -DBL_MAX
+ *
+ * Returns 0 if the record has no geometry, its geometry is empty or GEOS
+ * fails to give its bounds; callers skip the record then
+ */
+int clusterGIS_Get_envelope(clusterGIS_dataset* dataset, int record, double* envelope) {
+	GEOSGeometry* geometry = clusterGIS_Get_geometry(dataset, record);
+
+	if(geometry != NULL && GEOSisEmpty_r(clusterGIS_geos.handle, geometry) == 0
+		&& GEOSGeom_getXMin_r(clusterGIS_geos.handle, geometry, &envelope[0])
+		&& GEOSGeom_getYMin_r(clusterGIS_geos.handle, geometry, &envelope[1])
+		&& GEOSGeom_getXMax_r(clusterGIS_geos.handle, geometry, &envelope[2])
+		&& GEOSGeom_getYMax_r(clusterGIS_geos.handle, geometry, &envelope[3])) {
+		return 1;
+	}
+
+	envelope[0] = DBL_MAX;
+	envelope[1] = DBL_MAX;
+	envelope[2] = -DBL_MAX;
+	envelope[3] = -DBL_MAX;
+	return 0;
+}
+
 /* clusterGIS_Create_wkt_geometries
  *
  * Creates geometries in the dataset from the WKT formatted data in geometry_column
@@ -529,13 +2325,172 @@ MPI_Comm clusterGIS_Create_strided_communicator(MPI_Comm comm, int stride) {
  * geometry_column - column of the dataset the WKT formatted geometry is located in
  */
 void clusterGIS_Create_wkt_geometries(clusterGIS_dataset* dataset, int geometry_column) {
-	clusterGIS_record* record;
+	double start;
+	int i;
+
+	clusterGIS_Free_index(dataset);
+	clusterGIS_Free_envelopes(dataset);
+	free(dataset->pending);
+	dataset->pending = NULL;
+	dataset->geometry_column = geometry_column;
+	start = clusterGIS_Start_timer();
+	clusterGIS_Parallel_for(dataset->size, clusterGIS_Create_wkt_range, dataset);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_GEOMETRY_TIME, start);
+
+	if(dataset->views != NULL) {
+		for(i = 0; i < dataset->size; i++) {
+			dataset->views[i].geometry = dataset->geometries[i];
+		}
+	}
+}
+
+/* range function of clusterGIS_Create_wkt_geometries */
+static void clusterGIS_Create_wkt_range(clusterGIS_context* context, int start, int end, void* arg) {
+	clusterGIS_dataset* dataset = (clusterGIS_dataset*) arg;
+	int i;
+
+	for(i = start; i < end; i++) {
+		dataset->geometries[i] = GEOSWKTReader_read_r(context->handle, context->wkt_reader, clusterGIS_Get_field(dataset, i, dataset->geometry_column));
+	}
+	clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, end - start);
+}
+
+/* clusterGIS_Defer_wkt_geometries
+ *
+ * Makes the geometries of a dataset come from the WKT formatted data in
+ * geometry_column, like clusterGIS_Create_wkt_geometries, but each one is
+ * only created when it is first accessed with clusterGIS_Get_geometry.
+ * Envelopes are read from the WKT without creating geometries, so
+ * envelope checks such as those of clusterGIS_Filter_geometry only create
+ * the geometries of the candidates.
+ *
+ * dataset - dataset to be modified
+ * geometry_column - column of the dataset the WKT formatted geometry is located in
+ */
+void clusterGIS_Defer_wkt_geometries(clusterGIS_dataset* dataset, int geometry_column) {
+	int i;
+
+	clusterGIS_Free_index(dataset);
+	clusterGIS_Free_envelopes(dataset);
+	for(i = 0; i < dataset->size; i++) {
+		if(dataset->geometries[i] != NULL) {
+			GEOSGeom_destroy_r(clusterGIS_geos.handle, dataset->geometries[i]);
+			dataset->geometries[i] = NULL;
+		}
+		if(dataset->views != NULL) {
+			dataset->views[i].geometry = NULL;
+		}
+	}
+
+	dataset->geometry_column = geometry_column;
+	free(dataset->pending);
+	dataset->pending = malloc(dataset->capacity + 1);
+	memset(dataset->pending, 1, dataset->size);
+}
 
-	record = dataset->data;
-	while(record != NULL) {
-		clusterGIS_Create_wkt_geometry(record, geometry_column);
-		record = record->next;
+/* clusterGIS_Materialize_geometry_r
+ *
+ * Creates a record's geometry if it is still pending, see
+ * clusterGIS_Defer_wkt_geometries. Threads may call this for different
+ * records at once, each with its own context.
+ *
+ * context - GEOS context of the calling thread
+ * dataset - the dataset containing the record
+ * record - index of the record
+ *
+ * Returns the geometry of the record
+ */
+GEOSGeometry* clusterGIS_Materialize_geometry_r(clusterGIS_context* context, clusterGIS_dataset* dataset, int record) {
+	if(dataset->pending != NULL && dataset->pending[record]) {
+		dataset->geometries[record] = GEOSWKTReader_read_r(context->handle, context->wkt_reader, clusterGIS_Get_field(dataset, record, dataset->geometry_column));
+		dataset->pending[record] = 0;
+		clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, 1);
+	}
+
+	return dataset->geometries[record];
+}
+
+/* clusterGIS_Materialize_geometries
+ *
+ * Creates every pending geometry of a dataset, after which records added to
+ * it get no geometry, as with clusterGIS_Create_wkt_geometries
+ *
+ * dataset - the dataset
+ */
+void clusterGIS_Materialize_geometries(clusterGIS_dataset* dataset) {
+	double start;
+	int i;
+
+	if(dataset->pending == NULL) {
+		return;
+	}
+	start = clusterGIS_Start_timer();
+	clusterGIS_Parallel_for(dataset->size, clusterGIS_Materialize_range, dataset);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_GEOMETRY_TIME, start);
+	free(dataset->pending);
+	dataset->pending = NULL;
+
+	if(dataset->views != NULL) {
+		for(i = 0; i < dataset->size; i++) {
+			dataset->views[i].geometry = dataset->geometries[i];
+		}
+	}
+}
+
+/* range function of clusterGIS_Materialize_geometries */
+static void clusterGIS_Materialize_range(clusterGIS_context* context, int start, int end, void* arg) {
+	clusterGIS_dataset* dataset = (clusterGIS_dataset*) arg;
+	int i;
+
+	for(i = start; i < end; i++) {
+		clusterGIS_Materialize_geometry_r(context, dataset, i);
+	}
+}
+
+/* clusterGIS_Wkt_envelope
+ *
+ * Finds the envelope of a WKT formatted geometry from its coordinates,
+ * without creating the geometry. Any coordinates after x and y (z, m) are
+ * skipped.
+ *
+ * wkt - the WKT formatted geometry
+ * envelope - returned with xmin, ymin, xmax, ymax
+ *
+ * Returns 0 if the geometry is empty
+ */
+int clusterGIS_Wkt_envelope(char* wkt, double* envelope) {
+	char* c;
+	char* end;
+	double x;
+	double y;
+	int found = 0;
+
+	c = strchr(wkt, '(');
+	while(c != NULL && *c != '\0') {
+		if((*c >= '0' && *c <= '9') || *c == '-' || *c == '+' || *c == '.') {
+			/* a coordinate: x and y, then skip to the next one */
+			x = strtod(c, &end);
+			y = strtod(end, &end);
+			if(!found) {
+				envelope[0] = envelope[2] = x;
+				envelope[1] = envelope[3] = y;
+				found = 1;
+			}
+			if(x < envelope[0]) envelope[0] = x;
+			if(y < envelope[1]) envelope[1] = y;
+			if(x > envelope[2]) envelope[2] = x;
+			if(y > envelope[3]) envelope[3] = y;
+			c = end;
+			while(*c != '\0' && *c != ',' && *c != ')') {
+				c++;
+			}
+		} else {
+			/* brackets, separators and the names of nested geometries */
+			c++;
+		}
 	}
+
+	return found;
 }
 
 /* clusterGIS_Create_wkt_geometry
@@ -546,7 +2501,5 @@ void clusterGIS_Create_wkt_geometries(clusterGIS_dataset* dataset, int geometry_
  * geometry_column - the column in record->data containing the WKT formatted geometry data
  */
 void clusterGIS_Create_wkt_geometry(clusterGIS_record* record, int geometry_column) {
-	GEOSWKTReader* reader = GEOSWKTReader_create();
-	record->geometry = GEOSWKTReader_read(reader, record->data[geometry_column]);
-	GEOSWKTReader_destroy(reader);
+	record->geometry = GEOSWKTReader_read_r(clusterGIS_geos.handle, clusterGIS_geos.wkt_reader, record->data[geometry_column]);
 }
@@ -2,16 +2,30 @@
 #define CLUSTERGIS_H
 
 #define CLUSTERGIS_BUFFERSIZE 2*1024*1024
+#define CLUSTERGIS_ARENA_BLOCKSIZE 4*1024*1024
 
 #include "stdio.h"
 #include "stdlib.h"
 #include "mpi.h"
 #include "geos_c.h"
 
-/* variables */
-int clusterGIS_started;
-
 /* datatypes */
+
+/* a reentrant GEOS context and the readers and writers kept with it, thread
+ * is the number of the pool thread using it, see clusterGIS_Set_threads */
+struct clusterGIS_context {
+	GEOSContextHandle_t handle;
+	int thread;
+	GEOSWKTReader* wkt_reader;
+	GEOSWKTWriter* wkt_writer;
+	GEOSWKBReader* wkb_reader;
+	GEOSWKBWriter* wkb_writer;
+};
+typedef struct clusterGIS_context clusterGIS_context;
+
+/* work on items start to end - 1 of a parallel loop, see clusterGIS_Parallel_for */
+typedef void (*clusterGIS_range_function)(clusterGIS_context* context, int start, int end, void* arg);
+
 struct clusterGIS_record_el {
 	char** data;
 	int columns;
@@ -19,11 +33,192 @@ struct clusterGIS_record_el {
 	struct clusterGIS_record_el * next;
 };
 typedef struct clusterGIS_record_el clusterGIS_record;
+
+/* memory owned by a dataset, released all at once */
+struct clusterGIS_arena_block_el {
+	struct clusterGIS_arena_block_el* next;
+	size_t size;
+	size_t used;
+};
+typedef struct clusterGIS_arena_block_el clusterGIS_arena_block;
+struct clusterGIS_arena {
+	clusterGIS_arena_block* blocks;
+	size_t allocated;
+};
+typedef struct clusterGIS_arena clusterGIS_arena;
+
+/* envelopes of the first size records of a dataset, one array per bound so
+ * they can be scanned quickly; a record without a geometry has an empty
+ * envelope, min > max */
+struct clusterGIS_envelopes {
+	double* xmin;
+	double* ymin;
+	double* xmax;
+	double* ymax;
+	int size;
+};
+typedef struct clusterGIS_envelopes clusterGIS_envelopes;
+
+/* Dictionary encoding of a column, see clusterGIS_Encode_column. values
+ * holds the size distinct values of column, codes the code of each
+ * record's value, and records the records of each code, code c's being
+ * records[starts[c]] to records[starts[c + 1] - 1]. slots is a hash table
+ * of the codes by value, -1 in empty slots, and sorted the codes in the
+ * order of their values, so values sharing a prefix are adjacent. indexes
+ * holds an STRtree over the geometries of each code, see
+ * clusterGIS_Build_index. */
+struct clusterGIS_dictionary {
+	int column;
+	int size;
+	char** values;
+	int* codes;
+	int* starts;
+	int* records;
+	int* slots;
+	int slots_count;
+	int* sorted;
+	GEOSSTRtree** indexes;
+};
+typedef struct clusterGIS_dictionary clusterGIS_dictionary;
+
+/* Records are stored by column: the fields of record i are
+ * values[offsets[i]] to values[offsets[i + 1] - 1], with their lengths in
+ * lengths[], and its geometry is geometries[i], or is created from the WKT
+ * in geometry_column on first access if pending[i] is set, see
+ * clusterGIS_Defer_wkt_geometries. Loaded fields are '\0'
+ * terminated views into the load buffers retained by the arena. index is an
+ * optional STRtree over the geometries, see clusterGIS_Build_index, and
+ * envelopes optional cached envelopes, see clusterGIS_Build_envelopes.
+ * dictionary optionally encodes a column, see clusterGIS_Encode_column.
+ * extents holds xmin, ymin, xmax, ymax of the records on each task after
+ * clusterGIS_Repartition_spatial. mapping is a region of a binary file
+ * mapped by clusterGIS_Load_binary and window an MPI shared memory window
+ * from clusterGIS_Load_csv_shared, which loaded fields point into. A dataset
+ * with a window is freed or cleared collectively: every task of the node
+ * must call clusterGIS_Free_dataset or clusterGIS_Clear_dataset on its copy
+ * together, as MPI_Win_free is collective.
+ *
+ * data is a linked list of clusterGIS_record views over the same storage
+ * for code that walks the records. Loads no longer build it: data is NULL
+ * until clusterGIS_Link_records is called, and must be linked again after
+ * the dataset changes. */
 struct clusterGIS_dataset {
+	int size;
+	int capacity;
+	size_t* offsets;
+	char** values;
+	int* lengths;
+	size_t values_capacity;
+	GEOSGeometry** geometries;
+	char* pending;
+	int geometry_column;
+	GEOSSTRtree* index;
+	clusterGIS_envelopes envelopes;
+	clusterGIS_dictionary dictionary;
+	double* extents;
+	int extents_count;
+	clusterGIS_arena arena;
+	clusterGIS_record* views;
 	clusterGIS_record* data;
+	void* mapping;
+	size_t mapping_size;
+	MPI_Win window;
 };
 typedef struct clusterGIS_dataset clusterGIS_dataset;
 
+/* Options of the *_options load functions. Rows are only kept if the
+ * field in value_column starts with prefix, when value_column is not -1
+ * and prefix is not NULL, and if the envelope of the WKT in window_column
+ * overlaps window (xmin, ymin, xmax, ymax), when window_column is not -1.
+ * Rejected rows are dropped as the buffer is scanned, before any field is
+ * stored or geometry created. If columns is not NULL only the columns_count
+ * columns it lists are stored; the others read as empty fields, so columns
+ * keep their indexes, and columns after the last listed one are dropped.
+ *
+ * If chunk_size is not 0 a distributed load is scheduled dynamically: tasks
+ * claim chunks of chunk_size bytes from a shared counter until the file is
+ * exhausted, so tasks with cheap records load more of them. Each record is
+ * loaded by the task claiming the chunk it starts in; the records of a task
+ * are then no longer one contiguous part of the file.
+ *
+ * A distributed load reads buffers blocks of buffer_size bytes ahead, so
+ * reading overlaps splitting; the defaults are 2 and CLUSTERGIS_BUFFERSIZE.
+ *
+ * If encode_column is not -1 the column is dictionary encoded once the
+ * records are loaded, see clusterGIS_Encode_column. */
+struct clusterGIS_load_options {
+	int value_column;
+	char* prefix;
+	int window_column;
+	double window[4];
+	int* columns;
+	int columns_count;
+	long long chunk_size;
+	int buffers;
+	int buffer_size;
+	int encode_column;
+};
+typedef struct clusterGIS_load_options clusterGIS_load_options;
+
+/* A csv file read one batch of records at a time, see
+ * clusterGIS_Open_csv_stream. The records starting in rangestart to
+ * rangeend belong to the task; position is the offset of the next block to
+ * read, of buffer_size bytes, and buffer the block being read by request.
+ * carry holds the start of a record a block ended in, previous the last
+ * byte of the last block. started is set once the first record of the
+ * range was found, finished once its last record was split. */
+struct clusterGIS_csv_stream {
+	MPI_File file;
+	MPI_Offset filesize;
+	MPI_Offset rangestart;
+	MPI_Offset rangeend;
+	MPI_Offset position;
+	clusterGIS_load_options* options;
+	int buffer_size;
+	char* carry;
+	int carried;
+	char previous;
+	int started;
+	int finished;
+	char* buffer;
+	MPI_Offset offset;
+	MPI_Request request;
+};
+typedef struct clusterGIS_csv_stream clusterGIS_csv_stream;
+
+/* Statistics of a task, see clusterGIS_Report_stats: bytes read from
+ * files, csv records and fields parsed, calls creating or testing GEOS
+ * geometries, bytes allocated for datasets and buffers, and the time spent
+ * loading, creating geometries, testing predicates, writing and waiting in
+ * MPI, in nanoseconds. A phase run from within another, e.g. geometries
+ * created by a join, counts towards both. */
+#define CLUSTERGIS_STAT_BYTES_READ 0
+#define CLUSTERGIS_STAT_RECORDS_PARSED 1
+#define CLUSTERGIS_STAT_FIELDS_PARSED 2
+#define CLUSTERGIS_STAT_GEOS_CALLS 3
+#define CLUSTERGIS_STAT_BYTES_ALLOCATED 4
+#define CLUSTERGIS_STAT_LOAD_TIME 5
+#define CLUSTERGIS_STAT_GEOMETRY_TIME 6
+#define CLUSTERGIS_STAT_PREDICATE_TIME 7
+#define CLUSTERGIS_STAT_WRITE_TIME 8
+#define CLUSTERGIS_STAT_MPI_WAIT_TIME 9
+#define CLUSTERGIS_STATS 10
+struct clusterGIS_stats {
+	long long values[CLUSTERGIS_STATS];
+};
+typedef struct clusterGIS_stats clusterGIS_stats;
+
+/* variables */
+extern int clusterGIS_started;
+extern clusterGIS_context clusterGIS_geos;
+
+/* record access by index */
+#define clusterGIS_Get_field(dataset, record, column) ((dataset)->values[(dataset)->offsets[(record)] + (column)])
+#define clusterGIS_Get_length(dataset, record, column) ((dataset)->lengths[(dataset)->offsets[(record)] + (column)])
+#define clusterGIS_Get_columns(dataset, record) ((int) ((dataset)->offsets[(record) + 1] - (dataset)->offsets[(record)]))
+#define clusterGIS_Get_code(dataset, record) ((dataset)->dictionary.codes[(record)])
+#define clusterGIS_Get_geometry(dataset, record) ((dataset)->pending != NULL && (dataset)->pending[(record)] ? clusterGIS_Materialize_geometry_r(&clusterGIS_geos, (dataset), (record)) : (dataset)->geometries[(record)])
+
 /* startup and shutdown */
 void clusterGIS_Init(int* argc, char*** argv);
 void clusterGIS_Finalize(void);
@@ -31,10 +226,34 @@ void clusterGIS_Finalize(void);
 /* dataset operations */
 clusterGIS_dataset* clusterGIS_Create_dataset(void);
 clusterGIS_dataset* clusterGIS_Load_csv_distributed(MPI_Comm comm, char* filename);
+clusterGIS_dataset* clusterGIS_Load_csv_distributed_options(MPI_Comm comm, char* filename, clusterGIS_load_options* options);
+clusterGIS_load_options* clusterGIS_Create_load_options(void);
+void clusterGIS_Free_load_options(clusterGIS_load_options* options);
 clusterGIS_dataset* clusterGIS_Load_csv_replicated(MPI_Comm comm, char* filename);
+clusterGIS_dataset* clusterGIS_Load_csv_replicated_options(MPI_Comm comm, char* filename, clusterGIS_load_options* options);
+clusterGIS_dataset* clusterGIS_Load_csv_shared(MPI_Comm comm, char* filename);
+clusterGIS_dataset* clusterGIS_Load_csv_shared_options(MPI_Comm comm, char* filename, clusterGIS_load_options* options);
+clusterGIS_csv_stream* clusterGIS_Open_csv_stream(MPI_Comm comm, char* filename);
+clusterGIS_csv_stream* clusterGIS_Open_csv_stream_options(MPI_Comm comm, char* filename, clusterGIS_load_options* options);
+int clusterGIS_Next_batch(clusterGIS_csv_stream* stream, clusterGIS_dataset* batch);
+void clusterGIS_Close_csv_stream(clusterGIS_csv_stream* stream);
 void clusterGIS_Write_csv(char* filename, clusterGIS_dataset* dataset);
 void clusterGIS_Write_csv_distributed(MPI_Comm comm, char* filename, clusterGIS_dataset* dataset);
 void clusterGIS_Free_dataset(clusterGIS_dataset* dataset);
+void clusterGIS_Clear_dataset(clusterGIS_dataset* dataset);
+int clusterGIS_Append_record(clusterGIS_dataset* dataset, clusterGIS_record* record);
+int clusterGIS_Append_record_from_csv(clusterGIS_dataset* dataset, char* csv, int* start);
+void clusterGIS_Set_field(clusterGIS_dataset* dataset, int record, int column, char* value);
+int clusterGIS_Keep_records(clusterGIS_dataset* dataset, char* keep);
+clusterGIS_record* clusterGIS_Link_records(clusterGIS_dataset* dataset);
+void clusterGIS_Encode_column(clusterGIS_dataset* dataset, int column);
+int clusterGIS_Lookup_code(clusterGIS_dataset* dataset, char* value);
+void clusterGIS_Free_dictionary(clusterGIS_dataset* dataset);
+
+/* arena operations */
+void* clusterGIS_Arena_alloc(clusterGIS_arena* arena, size_t size);
+char* clusterGIS_Arena_strndup(clusterGIS_arena* arena, const char* string, size_t length);
+void clusterGIS_Arena_release(clusterGIS_arena* arena);
 
 /* record operations */
 clusterGIS_record* clusterGIS_Create_record_from_csv(char* csv, int* size);
@@ -47,5 +266,73 @@ MPI_Comm clusterGIS_Create_strided_communicator(MPI_Comm comm, int stride);
 /* Geometry operations */
 void clusterGIS_Create_wkt_geometries(clusterGIS_dataset* dataset, int geometry_column);
 void clusterGIS_Create_wkt_geometry(clusterGIS_record* record, int geometry_column);
+void clusterGIS_Defer_wkt_geometries(clusterGIS_dataset* dataset, int geometry_column);
+GEOSGeometry* clusterGIS_Materialize_geometry_r(clusterGIS_context* context, clusterGIS_dataset* dataset, int record);
+void clusterGIS_Materialize_geometries(clusterGIS_dataset* dataset);
+int clusterGIS_Wkt_envelope(char* wkt, double* envelope);
+
+/* Index operations */
+void clusterGIS_Build_index(clusterGIS_dataset* dataset);
+void clusterGIS_Free_index(clusterGIS_dataset* dataset);
+void clusterGIS_Build_envelopes(clusterGIS_dataset* dataset);
+void clusterGIS_Free_envelopes(clusterGIS_dataset* dataset);
+int clusterGIS_Query_intersects(clusterGIS_dataset* dataset, GEOSGeometry* geometry, int** results, int* capacity);
+int clusterGIS_Query_envelope(clusterGIS_dataset* dataset, double xmin, double ymin, double xmax, double ymax, int** results, int* capacity);
+int clusterGIS_Query_nearest(clusterGIS_dataset* dataset, GEOSGeometry* geometry, int column, char* value, double* distance);
+int clusterGIS_Query_nearest_r(clusterGIS_context* context, clusterGIS_dataset* dataset, GEOSGeometry* geometry, int column, char* value, double* distance);
+
+/* Filter operations */
+#define CLUSTERGIS_PREDICATE_INTERSECTS 0
+#define CLUSTERGIS_PREDICATE_CONTAINS 1
+#define CLUSTERGIS_PREDICATE_COVERS 2
+#define CLUSTERGIS_PREDICATE_WITHIN 3
+int clusterGIS_Filter_geometry(clusterGIS_dataset* dataset, GEOSGeometry* geometry, int predicate);
+int clusterGIS_Filter_distance(clusterGIS_dataset* dataset, GEOSGeometry* geometry, double distance);
+int clusterGIS_Envelopes_window(clusterGIS_envelopes* envelopes, int start, int end, double* window, char* matches);
+int clusterGIS_Envelopes_distance(clusterGIS_envelopes* envelopes, int start, int end, double* window, double distance, char* matches);
+#define CLUSTERGIS_SIMD_SCALAR 0
+#define CLUSTERGIS_SIMD_SSE2 1
+#define CLUSTERGIS_SIMD_AVX2 2
+void clusterGIS_Set_simd(int simd);
+int clusterGIS_Get_simd(void);
+
+/* Partition operations */
+#define CLUSTERGIS_SORT_STRING 0
+#define CLUSTERGIS_SORT_INTEGER 1
+#define CLUSTERGIS_SORT_NUMBER 2
+void clusterGIS_Exchange_records(MPI_Comm comm, clusterGIS_dataset* dataset, int* destinations);
+void clusterGIS_Repartition_spatial(MPI_Comm comm, clusterGIS_dataset* dataset);
+void clusterGIS_Repartition_by_key(MPI_Comm comm, clusterGIS_dataset* dataset, int column);
+int clusterGIS_Overlapping_ranks(clusterGIS_dataset* dataset, double xmin, double ymin, double xmax, double ymax, int* ranks);
+void clusterGIS_Sort(MPI_Comm comm, clusterGIS_dataset* dataset, int column, int type);
+
+/* Thread operations */
+void clusterGIS_Set_threads(int threads);
+int clusterGIS_Get_threads(void);
+void clusterGIS_Parallel_for(int count, clusterGIS_range_function function, void* arg);
+
+/* Binary file operations */
+void clusterGIS_Write_binary(MPI_Comm comm, char* filename, clusterGIS_dataset* dataset);
+clusterGIS_dataset* clusterGIS_Load_binary(MPI_Comm comm, char* filename, int map);
+
+/* Statistics operations */
+void clusterGIS_Reset_stats(void);
+void clusterGIS_Get_stats(clusterGIS_stats* stats);
+void clusterGIS_Report_stats(MPI_Comm comm);
+
+/* Aggregate operations */
+#define CLUSTERGIS_AGGREGATE_COUNT 0
+#define CLUSTERGIS_AGGREGATE_SUM 1
+#define CLUSTERGIS_AGGREGATE_MIN 2
+#define CLUSTERGIS_AGGREGATE_MAX 3
+#define CLUSTERGIS_AGGREGATE_AREA 4
+#define CLUSTERGIS_AGGREGATE_LENGTH 5
+clusterGIS_dataset* clusterGIS_Aggregate(MPI_Comm comm, clusterGIS_dataset* dataset, int* group_columns, int group_count, int* functions, int* columns, int count);
+
+/* Join operations, clusterGIS_Nearest_join matches a right record when its
+ * field in match_column starts with the left record's field, so a left "R"
+ * matches right "R" and "R1" but a left "R1" does not match a right "R" */
+clusterGIS_dataset* clusterGIS_Nearest_join(clusterGIS_dataset* left, clusterGIS_dataset* right, MPI_Comm comm, int left_id_column, int right_id_column, int match_column);
+clusterGIS_dataset* clusterGIS_Spatial_join(MPI_Comm comm, clusterGIS_dataset* left, clusterGIS_dataset* right, int left_id_column, int right_id_column, int predicate);
 
 #endif
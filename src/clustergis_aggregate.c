@@ -0,0 +1,432 @@
+#include "clustergis.h"
+#include "clustergis_internal.h"
+#include "string.h"
+#include "float.h"
+#include "limits.h"
+
+/* partial aggregates of the groups found so far, in a hash table by key */
+struct clusterGIS_groups {
+	int size;
+	int capacity;
+	char** keys;
+	int* lengths;
+	double* values;
+	int* slots;
+	int slots_count;
+	int* functions;
+	int count;
+};
+
+/* clusterGIS_Create_groups
+ *
+ * Creates an empty table of groups
+ *
+ * groups - the table to set up
+ * functions - CLUSTERGIS_AGGREGATE_* function of each aggregate
+ * count - number of aggregates per group
+ */
+static void clusterGIS_Create_groups(struct clusterGIS_groups* groups, int* functions, int count) {
+	int i;
+
+	groups->size = 0;
+	groups->capacity = 16;
+	groups->keys = malloc(groups->capacity * sizeof(char*));
+	groups->lengths = malloc(groups->capacity * sizeof(int));
+	groups->values = malloc(groups->capacity * (count + 1) * sizeof(double));
+	groups->slots_count = 64;
+	groups->slots = malloc(groups->slots_count * sizeof(int));
+	for(i = 0; i < groups->slots_count; i++) {
+		groups->slots[i] = -1;
+	}
+	groups->functions = functions;
+	groups->count = count;
+}
+
+/* clusterGIS_Free_groups
+ *
+ * Frees a table of groups
+ */
+static void clusterGIS_Free_groups(struct clusterGIS_groups* groups) {
+	int i;
+
+	for(i = 0; i < groups->size; i++) {
+		free(groups->keys[i]);
+	}
+	free(groups->keys);
+	free(groups->lengths);
+	free(groups->values);
+	free(groups->slots);
+}
+
+/* clusterGIS_Find_group_slot
+ *
+ * Returns the slot of the table holding a key's group, or the empty slot
+ * where it belongs
+ */
+static int clusterGIS_Find_group_slot(struct clusterGIS_groups* groups, const char* key, int length) {
+	int slot;
+	int group;
+
+	slot = clusterGIS_Hash(key, length) & (groups->slots_count - 1);
+	while((group = groups->slots[slot]) >= 0) {
+		if(groups->lengths[group] == length && memcmp(groups->keys[group], key, length) == 0) {
+			break;
+		}
+		slot = (slot + 1) & (groups->slots_count - 1);
+	}
+
+	return slot;
+}
+
+/* clusterGIS_Empty_aggregate
+ *
+ * Returns the value of an aggregate before anything is combined into it,
+ * which combining leaves unchanged
+ *
+ * function - CLUSTERGIS_AGGREGATE_* function of the aggregate
+ */
+static double clusterGIS_Empty_aggregate(int function) {
+	if(function == CLUSTERGIS_AGGREGATE_MIN) {
+		return DBL_MAX;
+	} else if(function == CLUSTERGIS_AGGREGATE_MAX) {
+		return -DBL_MAX;
+	}
+	return 0;
+}
+
+/* clusterGIS_Find_group
+ *
+ * Finds the group of a key, adding it with empty aggregates if it is new
+ *
+ * groups - the table of groups
+ * key - the key, which may hold '\0' bytes
+ * length - length of the key
+ *
+ * Returns the index of the group
+ */
+static int clusterGIS_Find_group(struct clusterGIS_groups* groups, const char* key, int length) {
+	double* values;
+	int slot;
+	int group;
+	int i;
+
+	slot = clusterGIS_Find_group_slot(groups, key, length);
+	if(groups->slots[slot] >= 0) {
+		return groups->slots[slot];
+	}
+
+	if(groups->size == groups->capacity) {
+		groups->capacity *= 2;
+		groups->keys = realloc(groups->keys, groups->capacity * sizeof(char*));
+		groups->lengths = realloc(groups->lengths, groups->capacity * sizeof(int));
+		groups->values = realloc(groups->values, groups->capacity * (groups->count + 1) * sizeof(double));
+		if(groups->keys == NULL || groups->lengths == NULL || groups->values == NULL) {
+			fprintf(stderr, "clusterGIS_Find_group: out of memory for %d groups\n", groups->capacity);
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		}
+	}
+	group = groups->size++;
+	groups->keys[group] = malloc(length + 1);
+	memcpy(groups->keys[group], key, length);
+	groups->lengths[group] = length;
+	groups->slots[slot] = group;
+
+	values = &groups->values[group * groups->count];
+	for(i = 0; i < groups->count; i++) {
+		values[i] = clusterGIS_Empty_aggregate(groups->functions[i]);
+	}
+
+	/* keep the table at most half full */
+	if(groups->size * 2 > groups->slots_count) {
+		free(groups->slots);
+		groups->slots_count *= 2;
+		groups->slots = malloc(groups->slots_count * sizeof(int));
+		for(i = 0; i < groups->slots_count; i++) {
+			groups->slots[i] = -1;
+		}
+		for(i = 0; i < groups->size; i++) {
+			groups->slots[clusterGIS_Find_group_slot(groups, groups->keys[i], groups->lengths[i])] = i;
+		}
+	}
+
+	return group;
+}
+
+/* clusterGIS_Combine_group
+ *
+ * Combines values into the aggregates of a group. The values of one record
+ * and the partial aggregates of another task combine the same way.
+ *
+ * groups - the table of groups
+ * group - index of the group
+ * values - one value per aggregate
+ */
+static void clusterGIS_Combine_group(struct clusterGIS_groups* groups, int group, double* values) {
+	double* aggregates = &groups->values[group * groups->count];
+	int i;
+
+	for(i = 0; i < groups->count; i++) {
+		if(groups->functions[i] == CLUSTERGIS_AGGREGATE_MIN) {
+			if(values[i] < aggregates[i]) {
+				aggregates[i] = values[i];
+			}
+		} else if(groups->functions[i] == CLUSTERGIS_AGGREGATE_MAX) {
+			if(values[i] > aggregates[i]) {
+				aggregates[i] = values[i];
+			}
+		} else {
+			aggregates[i] += values[i];
+		}
+	}
+}
+
+/* clusterGIS_Group_key
+ *
+ * Builds the key of a record's group, the length and bytes of each group
+ * column in turn, so no two different sets of values share a key
+ *
+ * buffer - returned with the key, grown as needed
+ * size - size of buffer
+ * dataset - the dataset
+ * record - the record
+ * group_columns - the columns to group by
+ * group_count - number of group columns
+ *
+ * Returns the length of the key
+ */
+static int clusterGIS_Group_key(char** buffer, int* size, clusterGIS_dataset* dataset, int record, int* group_columns, int group_count) {
+	int field_length;
+	int length;
+	int needed;
+	int i;
+
+	needed = 0;
+	for(i = 0; i < group_count; i++) {
+		needed += sizeof(int) + (group_columns[i] < clusterGIS_Get_columns(dataset, record) ? clusterGIS_Get_length(dataset, record, group_columns[i]) : 0);
+	}
+	if(needed + 1 > *size) {
+		*size = 2 * (needed + 1);
+		*buffer = realloc(*buffer, *size);
+	}
+
+	length = 0;
+	for(i = 0; i < group_count; i++) {
+		field_length = group_columns[i] < clusterGIS_Get_columns(dataset, record) ? clusterGIS_Get_length(dataset, record, group_columns[i]) : 0;
+		memcpy(*buffer + length, &field_length, sizeof(int));
+		length += sizeof(int);
+		if(field_length > 0) {
+			memcpy(*buffer + length, clusterGIS_Get_field(dataset, record, group_columns[i]), field_length);
+			length += field_length;
+		}
+	}
+
+	return length;
+}
+
+/* clusterGIS_Aggregate
+ *
+ * Computes aggregates of the records of a distributed dataset grouped by
+ * the values of one or more columns. Each task first combines its own
+ * records in a hash table, then the partial aggregates are sent to the task
+ * hash(group) % size with a single MPI_Alltoallv and combined there, so
+ * each group travels at most once from each task.
+ *
+ * comm - MPI communicator of the participants of the distributed dataset
+ * dataset - the dataset, it is not changed
+ * group_columns - the columns to group by, records without a column have ""
+ * group_count - number of group columns, 0 puts every record in one group
+ * functions - CLUSTERGIS_AGGREGATE_COUNT counts the records of a group,
+ *             _SUM, _MIN and _MAX combine the numbers in a column and _AREA
+ *             and _LENGTH sum the area or length of the geometries, which
+ *             must have been created or deferred
+ * columns - the column of each _SUM, _MIN and _MAX aggregate, its fields are
+ *           read with strtod and a missing field or one that does not start
+ *           with a number is skipped; the entries of other aggregates are
+ *           ignored
+ * count - number of aggregates
+ *
+ * Returns a distributed dataset with a record per group, its group column
+ * values followed by its aggregates. A _MIN of a group whose column holds no
+ * numbers stays at 1.7976931348623157e+308 (DBL_MAX) and a _MAX at
+ * -1.7976931348623157e+308.
+ */
+clusterGIS_dataset* clusterGIS_Aggregate(MPI_Comm comm, clusterGIS_dataset* dataset, int* group_columns, int group_count, int* functions, int* columns, int count) {
+	struct clusterGIS_groups local;
+	struct clusterGIS_groups merged;
+	clusterGIS_dataset* output;
+	GEOSGeometry* geometry;
+	double* values;
+	char* key;
+	int key_size;
+	int length;
+	int comm_size;
+	int* destinations;
+	long long* sendsizes;
+	int* sendcounts;
+	int* sdispls;
+	int* recvcounts;
+	int* rdispls;
+	int* positions;
+	char* sendbuffer;
+	char* recvbuffer;
+	char* line;
+	char* text;
+	char* end;
+	double number;
+	long long total;
+	long long entry;
+	double start;
+	int position;
+	int record;
+	int group;
+	int field;
+	int i;
+
+	MPI_Comm_size(comm, &comm_size);
+
+	for(i = 0; i < count; i++) {
+		if(functions[i] < CLUSTERGIS_AGGREGATE_COUNT || functions[i] > CLUSTERGIS_AGGREGATE_LENGTH) {
+			fprintf(stderr, "clusterGIS_Aggregate: unknown aggregate function %d\n", functions[i]);
+			MPI_Abort(comm, 1);
+		}
+		if((functions[i] == CLUSTERGIS_AGGREGATE_AREA || functions[i] == CLUSTERGIS_AGGREGATE_LENGTH) && dataset->geometry_column < 0) {
+			fprintf(stderr, "clusterGIS_Aggregate: dataset has no geometries\n");
+			MPI_Abort(comm, 1);
+		}
+	}
+
+	/* combine the records of this task */
+	clusterGIS_Create_groups(&local, functions, count);
+	values = malloc((count + 1) * sizeof(double));
+	key_size = 256;
+	key = malloc(key_size);
+	for(record = 0; record < dataset->size; record++) {
+		length = clusterGIS_Group_key(&key, &key_size, dataset, record, group_columns, group_count);
+		group = clusterGIS_Find_group(&local, key, length);
+
+		for(i = 0; i < count; i++) {
+			if(functions[i] == CLUSTERGIS_AGGREGATE_COUNT) {
+				values[i] = 1;
+			} else if(functions[i] == CLUSTERGIS_AGGREGATE_AREA || functions[i] == CLUSTERGIS_AGGREGATE_LENGTH) {
+				values[i] = 0;
+				geometry = clusterGIS_Get_geometry(dataset, record);
+				if(geometry != NULL) {
+					if(functions[i] == CLUSTERGIS_AGGREGATE_AREA) {
+						GEOSArea_r(clusterGIS_geos.handle, geometry, &values[i]);
+					} else {
+						GEOSLength_r(clusterGIS_geos.handle, geometry, &values[i]);
+					}
+					clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, 1);
+				}
+			} else {
+				field = columns[i];
+				values[i] = clusterGIS_Empty_aggregate(functions[i]);
+				if(field < clusterGIS_Get_columns(dataset, record)) {
+					text = clusterGIS_Get_field(dataset, record, field);
+					number = strtod(text, &end);
+					if(end != text) {
+						values[i] = number;
+					}
+				}
+			}
+		}
+		clusterGIS_Combine_group(&local, group, values);
+	}
+
+	/* each group travels as its key length, key and partial aggregates */
+	destinations = malloc((local.size + 1) * sizeof(int));
+	sendsizes = calloc(comm_size, sizeof(long long));
+	sendcounts = malloc(comm_size * sizeof(int));
+	sdispls = malloc(comm_size * sizeof(int));
+	recvcounts = malloc(comm_size * sizeof(int));
+	rdispls = malloc(comm_size * sizeof(int));
+	positions = malloc(comm_size * sizeof(int));
+	for(group = 0; group < local.size; group++) {
+		destinations[group] = clusterGIS_Hash(local.keys[group], local.lengths[group]) % comm_size;
+		sendsizes[destinations[group]] += sizeof(int) + local.lengths[group] + count * sizeof(double);
+	}
+	total = 0;
+	for(i = 0; i < comm_size; i++) {
+		if(total + sendsizes[i] > INT_MAX) {
+			fprintf(stderr, "clusterGIS_Aggregate: more than %d bytes to send\n", INT_MAX);
+			MPI_Abort(comm, 1);
+		}
+		sendcounts[i] = sendsizes[i];
+		sdispls[i] = total;
+		positions[i] = total;
+		total += sendsizes[i];
+	}
+
+	start = clusterGIS_Start_timer();
+	MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, comm);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, start);
+
+	sendbuffer = malloc(total + 1);
+	for(group = 0; group < local.size; group++) {
+		line = sendbuffer + positions[destinations[group]];
+		memcpy(line, &local.lengths[group], sizeof(int));
+		memcpy(line + sizeof(int), local.keys[group], local.lengths[group]);
+		memcpy(line + sizeof(int) + local.lengths[group], &local.values[group * count], count * sizeof(double));
+		positions[destinations[group]] += sizeof(int) + local.lengths[group] + count * sizeof(double);
+	}
+
+	total = 0;
+	for(i = 0; i < comm_size; i++) {
+		if(total + recvcounts[i] > INT_MAX) {
+			fprintf(stderr, "clusterGIS_Aggregate: more than %d bytes to receive\n", INT_MAX);
+			MPI_Abort(comm, 1);
+		}
+		rdispls[i] = total;
+		total += recvcounts[i];
+	}
+	recvbuffer = malloc(total + 1);
+	start = clusterGIS_Start_timer();
+	MPI_Alltoallv(sendbuffer, sendcounts, sdispls, MPI_CHAR, recvbuffer, recvcounts, rdispls, MPI_CHAR, comm);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, start);
+
+	/* combine the partial aggregates of the groups this task owns */
+	clusterGIS_Create_groups(&merged, functions, count);
+	entry = 0;
+	while(entry < total) {
+		memcpy(&length, recvbuffer + entry, sizeof(int));
+		group = clusterGIS_Find_group(&merged, recvbuffer + entry + sizeof(int), length);
+		memcpy(values, recvbuffer + entry + sizeof(int) + length, count * sizeof(double));
+		clusterGIS_Combine_group(&merged, group, values);
+		entry += sizeof(int) + length + count * sizeof(double);
+	}
+
+	/* build the output dataset, the group values are unpacked from the key */
+	output = clusterGIS_Create_dataset();
+	for(group = 0; group < merged.size; group++) {
+		record = clusterGIS_Add_record(output, group_count + count);
+		position = 0;
+		for(field = 0; field < group_count; field++) {
+			memcpy(&length, merged.keys[group] + position, sizeof(int));
+			position += sizeof(int);
+			clusterGIS_Get_field(output, record, field) = clusterGIS_Arena_strndup(&output->arena, merged.keys[group] + position, length);
+			clusterGIS_Get_length(output, record, field) = length;
+			position += length;
+		}
+		for(i = 0; i < count; i++) {
+			line = clusterGIS_Arena_alloc(&output->arena, 28);
+			clusterGIS_Get_field(output, record, group_count + i) = line;
+			clusterGIS_Get_length(output, record, group_count + i) = sprintf(line, "%.17g", merged.values[group * count + i]);
+		}
+	}
+
+	clusterGIS_Free_groups(&local);
+	clusterGIS_Free_groups(&merged);
+	free(values);
+	free(key);
+	free(destinations);
+	free(sendsizes);
+	free(sendcounts);
+	free(sdispls);
+	free(recvcounts);
+	free(rdispls);
+	free(positions);
+	free(sendbuffer);
+	free(recvbuffer);
+
+	return output;
+}
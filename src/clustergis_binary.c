@@ -0,0 +1,493 @@
+#include "clustergis.h"
+#include "clustergis_internal.h"
+#include "string.h"
+#include "float.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* A binary dataset file is
+ *
+ *   magic
+ *   one block per writing task
+ *   footer: a clusterGIS_binary_block entry per block
+ *   trailer: footer offset, block count, magic
+ *
+ * A block holds the records column by column so it can be used without
+ * parsing. Offsets inside a block are relative to its start and every
+ * section starts on an 8 byte boundary:
+ *
+ *   long long sections[columns + 1]  start of each column and of the WKB
+ *   int counts[records]              number of fields of each record
+ *   per column: long long ends[records], then the '\0' terminated fields
+ *   WKB: long long ends[records], then the WKB of each geometry
+ *
+ * ends[i] is where the data of record i ends, so record i runs from
+ * ends[i - 1] (0 for the first record) to ends[i]; records without the
+ * column or without a geometry are empty. Numbers are in the byte order of
+ * the machine which wrote the file. */
+#define CLUSTERGIS_BINARY_MAGIC "CGISBIN1"
+#define CLUSTERGIS_BINARY_ALIGN(n) (((n) + 7) & ~((long long) 7))
+
+struct clusterGIS_binary_block {
+	long long offset;
+	long long length;
+	long long records;
+	int columns;
+	int geometry_column;
+	double bbox[4];
+};
+typedef struct clusterGIS_binary_block clusterGIS_binary_block;
+
+struct clusterGIS_binary_trailer {
+	long long footer;
+	long long blocks;
+	char magic[8];
+};
+typedef struct clusterGIS_binary_trailer clusterGIS_binary_trailer;
+
+/* WKB of the geometries of a dataset while it is written */
+struct clusterGIS_wkb {
+	clusterGIS_dataset* dataset;
+	unsigned char** data;
+	size_t* sizes;
+};
+
+/* a block being loaded, see clusterGIS_Load_binary */
+struct clusterGIS_wkb_block {
+	clusterGIS_dataset* dataset;
+	int first;
+	char* wkb;
+	long long* ends;
+};
+
+static long long clusterGIS_Format_block(char* buffer, clusterGIS_dataset* dataset, int columns, struct clusterGIS_wkb* wkb);
+static void clusterGIS_Load_block(clusterGIS_dataset* dataset, char* block, clusterGIS_binary_block* entry);
+static void clusterGIS_Write_wkb_range(clusterGIS_context* context, int start, int end, void* arg);
+static void clusterGIS_Read_wkb_range(clusterGIS_context* context, int start, int end, void* arg);
+
+/* clusterGIS_Write_binary
+ *
+ * Writes a distributed dataset as a binary file with one block per task,
+ * which clusterGIS_Load_binary can load without parsing. Geometries are
+ * stored as WKB along with the fields.
+ *
+ * comm - MPI communicator of the participants of the distributed dataset
+ * filename - path of the file to write to
+ * dataset - the local part of the dataset
+ */
+void clusterGIS_Write_binary(MPI_Comm comm, char* filename, clusterGIS_dataset* dataset) {
+	clusterGIS_binary_block entry;
+	clusterGIS_binary_block* footer;
+	clusterGIS_binary_trailer trailer;
+	struct clusterGIS_wkb wkb;
+	double envelope[4];
+	long long size;
+	long long offset;
+	long long end;
+	char* buffer;
+	MPI_File file;
+	MPI_Status status;
+	int columns;
+	int record;
+	int comm_rank;
+	int comm_size;
+	int err;
+	double timer;
+
+	timer = clusterGIS_Start_timer();
+	MPI_Comm_rank(comm, &comm_rank);
+	MPI_Comm_size(comm, &comm_size);
+
+	/* Geometries to WKB, in parallel as they are independent */
+	wkb.dataset = dataset;
+	wkb.data = calloc(dataset->size + 1, sizeof(unsigned char*));
+	wkb.sizes = calloc(dataset->size + 1, sizeof(size_t));
+	clusterGIS_Parallel_for(dataset->size, clusterGIS_Write_wkb_range, &wkb);
+
+	entry.records = dataset->size;
+	entry.geometry_column = dataset->geometry_column;
+	entry.bbox[0] = DBL_MAX;
+	entry.bbox[1] = DBL_MAX;
+	entry.bbox[2] = -DBL_MAX;
+	entry.bbox[3] = -DBL_MAX;
+	columns = 0;
+	for(record = 0; record < dataset->size; record++) {
+		if(clusterGIS_Get_columns(dataset, record) > columns) {
+			columns = clusterGIS_Get_columns(dataset, record);
+		}
+		if(clusterGIS_Get_envelope(dataset, record, envelope)) {
+			if(envelope[0] < entry.bbox[0]) entry.bbox[0] = envelope[0];
+			if(envelope[1] < entry.bbox[1]) entry.bbox[1] = envelope[1];
+			if(envelope[2] > entry.bbox[2]) entry.bbox[2] = envelope[2];
+			if(envelope[3] > entry.bbox[3]) entry.bbox[3] = envelope[3];
+		}
+	}
+	entry.columns = columns;
+
+	/* Size the block, then format it */
+	size = clusterGIS_Format_block(NULL, dataset, columns, &wkb);
+	buffer = malloc(size + 1);
+	clusterGIS_Format_block(buffer, dataset, columns, &wkb);
+	for(record = 0; record < dataset->size; record++) {
+		if(wkb.data[record] != NULL) {
+			GEOSFree_r(clusterGIS_geos.handle, wkb.data[record]);
+		}
+	}
+	free(wkb.data);
+	free(wkb.sizes);
+
+	/* The local block starts after the blocks of the lower ranks */
+	offset = 0;
+	MPI_Exscan(&size, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+	if(comm_rank == 0) {
+		offset = 0;
+	}
+	offset += 8;
+	entry.offset = offset;
+	entry.length = size;
+
+	footer = NULL;
+	if(comm_rank == 0) {
+		footer = malloc(comm_size * sizeof(clusterGIS_binary_block));
+	}
+	MPI_Gather(&entry, sizeof(clusterGIS_binary_block), MPI_BYTE, footer, sizeof(clusterGIS_binary_block), MPI_BYTE, 0, comm);
+
+	err = MPI_File_open(comm, filename, MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &file);
+	if(err != MPI_SUCCESS) {
+		fprintf(stderr, "%d: Error opening file %s\n", comm_rank, filename);
+		MPI_Abort(comm, err);
+	}
+	MPI_File_set_size(file, 0);
+
+	clusterGIS_File_write_at_all(file, offset, buffer, size);
+
+	/* The last block ends where the footer starts */
+	end = offset + size;
+	MPI_Bcast(&end, 1, MPI_LONG_LONG, comm_size - 1, comm);
+	if(comm_rank == 0) {
+		trailer.footer = end;
+		trailer.blocks = comm_size;
+		memcpy(trailer.magic, CLUSTERGIS_BINARY_MAGIC, 8);
+		MPI_File_write_at(file, 0, CLUSTERGIS_BINARY_MAGIC, 8, MPI_CHAR, &status);
+		MPI_File_write_at(file, end, footer, comm_size * sizeof(clusterGIS_binary_block), MPI_BYTE, &status);
+		MPI_File_write_at(file, end + comm_size * sizeof(clusterGIS_binary_block), &trailer, sizeof(clusterGIS_binary_trailer), MPI_BYTE, &status);
+		free(footer);
+	}
+
+	MPI_File_close(&file);
+	free(buffer);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_WRITE_TIME, timer);
+}
+
+/* clusterGIS_Format_block
+ *
+ * Lays out the records of a dataset as a block of a binary file
+ *
+ * buffer - where the block is written, NULL to only size it
+ * dataset - the dataset
+ * columns - the largest number of fields of a record
+ * wkb - the WKB of the geometries
+ *
+ * Returns the size of the block in bytes
+ */
+static long long clusterGIS_Format_block(char* buffer, clusterGIS_dataset* dataset, int columns, struct clusterGIS_wkb* wkb) {
+	long long position;
+	long long end;
+	long long* sections;
+	long long* ends;
+	int* counts;
+	int record;
+	int column;
+
+	sections = (long long*) buffer;
+	position = CLUSTERGIS_BINARY_ALIGN((columns + 1) * (long long) sizeof(long long));
+
+	counts = (int*) (buffer + position);
+	if(buffer != NULL) {
+		for(record = 0; record < dataset->size; record++) {
+			counts[record] = clusterGIS_Get_columns(dataset, record);
+		}
+	}
+	position = CLUSTERGIS_BINARY_ALIGN(position + dataset->size * (long long) sizeof(int));
+
+	for(column = 0; column < columns; column++) {
+		ends = (long long*) (buffer + position);
+		if(buffer != NULL) {
+			sections[column] = position;
+		}
+		position += dataset->size * (long long) sizeof(long long);
+		end = 0;
+		for(record = 0; record < dataset->size; record++) {
+			if(column < clusterGIS_Get_columns(dataset, record)) {
+				if(buffer != NULL) {
+					memcpy(buffer + position + end, clusterGIS_Get_field(dataset, record, column), clusterGIS_Get_length(dataset, record, column));
+					buffer[position + end + clusterGIS_Get_length(dataset, record, column)] = '\0';
+				}
+				end += clusterGIS_Get_length(dataset, record, column) + 1;
+			}
+			if(buffer != NULL) {
+				ends[record] = end;
+			}
+		}
+		position = CLUSTERGIS_BINARY_ALIGN(position + end);
+	}
+
+	ends = (long long*) (buffer + position);
+	if(buffer != NULL) {
+		sections[columns] = position;
+	}
+	position += dataset->size * (long long) sizeof(long long);
+	end = 0;
+	for(record = 0; record < dataset->size; record++) {
+		if(buffer != NULL) {
+			memcpy(buffer + position + end, wkb->data[record], wkb->sizes[record]);
+		}
+		end += wkb->sizes[record];
+		if(buffer != NULL) {
+			ends[record] = end;
+		}
+	}
+	position = CLUSTERGIS_BINARY_ALIGN(position + end);
+
+	return position;
+}
+
+/* range function of clusterGIS_Write_binary */
+static void clusterGIS_Write_wkb_range(clusterGIS_context* context, int start, int end, void* arg) {
+	struct clusterGIS_wkb* wkb = (struct clusterGIS_wkb*) arg;
+	GEOSGeometry* geometry;
+	int i;
+
+	for(i = start; i < end; i++) {
+		geometry = clusterGIS_Materialize_geometry_r(context, wkb->dataset, i);
+		if(geometry != NULL) {
+			wkb->data[i] = GEOSWKBWriter_write_r(context->handle, context->wkb_writer, geometry, &wkb->sizes[i]);
+			clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, 1);
+		}
+	}
+}
+
+/* clusterGIS_Load_binary
+ *
+ * Loads a binary file written by clusterGIS_Write_binary. When there are as
+ * many tasks as blocks, task i gets block i, so a dataset is loaded as it
+ * was partitioned when written. Otherwise the blocks are shared out
+ * contiguously, each to the task whose share of the records holds its
+ * middle record, so each task gets about the same number of records. Each
+ * task reads only its own blocks: memory mapped, or with collective MPI-IO
+ * into memory. Fields point into the blocks, geometries are created from
+ * the WKB, and the extent of every task is set from the bounding boxes in
+ * the footer, see clusterGIS_Overlapping_ranks.
+ *
+ * comm - MPI communicator of which each member gets part of the dataset
+ * filename - path to the binary file
+ * map - nonzero to memory map the blocks read only, so their fields must
+ *       not be written to, zero to read them with MPI-IO
+ *
+ * Returns the local part of the dataset
+ */
+clusterGIS_dataset* clusterGIS_Load_binary(MPI_Comm comm, char* filename, int map) {
+	clusterGIS_binary_trailer trailer;
+	clusterGIS_binary_block* footer;
+	clusterGIS_dataset* dataset;
+	MPI_File file;
+	MPI_Offset filesize;
+	MPI_Status status;
+	char magic[8];
+	long long total;
+	long long seen;
+	long long start;
+	long long end;
+	long long page;
+	char* blocks;
+	int* owners;
+	int first;
+	int last;
+	int rank;
+	int fd;
+	int i;
+	int comm_rank;
+	int comm_size;
+	int err;
+	double timer;
+
+	timer = clusterGIS_Start_timer();
+	MPI_Comm_rank(comm, &comm_rank);
+	MPI_Comm_size(comm, &comm_size);
+
+	err = MPI_File_open(comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+	if(err != MPI_SUCCESS) {
+		fprintf(stderr, "%d: Error opening file %s\n", comm_rank, filename);
+		MPI_Abort(comm, err);
+	}
+
+	/* One task reads the footer and shares it */
+	if(comm_rank == 0) {
+		MPI_File_get_size(file, &filesize);
+		MPI_File_read_at(file, 0, magic, 8, MPI_CHAR, &status);
+		MPI_File_read_at(file, filesize - sizeof(clusterGIS_binary_trailer), &trailer, sizeof(clusterGIS_binary_trailer), MPI_BYTE, &status);
+		if(memcmp(magic, CLUSTERGIS_BINARY_MAGIC, 8) != 0 || memcmp(trailer.magic, CLUSTERGIS_BINARY_MAGIC, 8) != 0) {
+			fprintf(stderr, "%d: %s is not a clusterGIS binary file\n", comm_rank, filename);
+			MPI_Abort(comm, 1);
+		}
+	}
+	MPI_Bcast(&trailer, sizeof(clusterGIS_binary_trailer), MPI_BYTE, 0, comm);
+	footer = malloc(trailer.blocks * sizeof(clusterGIS_binary_block));
+	if(comm_rank == 0) {
+		MPI_File_read_at(file, trailer.footer, footer, trailer.blocks * sizeof(clusterGIS_binary_block), MPI_BYTE, &status);
+	}
+	MPI_Bcast(footer, trailer.blocks * sizeof(clusterGIS_binary_block), MPI_BYTE, 0, comm);
+
+	/* A block goes to the task of the same number, or to the task whose
+	 * share of the records its middle record is in */
+	total = 0;
+	for(i = 0; i < trailer.blocks; i++) {
+		total += footer[i].records;
+	}
+	owners = malloc(trailer.blocks * sizeof(int));
+	seen = 0;
+	first = trailer.blocks;
+	last = -1;
+	for(i = 0; i < trailer.blocks; i++) {
+		if(trailer.blocks == comm_size) {
+			owners[i] = i;
+		} else {
+			owners[i] = total == 0 ? 0 : (int) ((seen + footer[i].records / 2) * comm_size / total);
+			if(owners[i] >= comm_size) {
+				owners[i] = comm_size - 1;
+			}
+		}
+		seen += footer[i].records;
+		if(owners[i] == comm_rank) {
+			if(i < first) first = i;
+			last = i;
+		}
+	}
+
+	/* Every task knows where all blocks went, so extents need no communication */
+	dataset = clusterGIS_Create_dataset();
+	dataset->extents = malloc(4 * comm_size * sizeof(double));
+	dataset->extents_count = comm_size;
+	for(rank = 0; rank < comm_size; rank++) {
+		dataset->extents[4 * rank] = DBL_MAX;
+		dataset->extents[4 * rank + 1] = DBL_MAX;
+		dataset->extents[4 * rank + 2] = -DBL_MAX;
+		dataset->extents[4 * rank + 3] = -DBL_MAX;
+	}
+	for(i = 0; i < trailer.blocks; i++) {
+		rank = owners[i];
+		if(footer[i].records == 0) {
+			continue;
+		}
+		if(footer[i].bbox[0] < dataset->extents[4 * rank]) dataset->extents[4 * rank] = footer[i].bbox[0];
+		if(footer[i].bbox[1] < dataset->extents[4 * rank + 1]) dataset->extents[4 * rank + 1] = footer[i].bbox[1];
+		if(footer[i].bbox[2] > dataset->extents[4 * rank + 2]) dataset->extents[4 * rank + 2] = footer[i].bbox[2];
+		if(footer[i].bbox[3] > dataset->extents[4 * rank + 3]) dataset->extents[4 * rank + 3] = footer[i].bbox[3];
+	}
+
+	/* The blocks of a task are contiguous in the file, read them in one go */
+	start = 0;
+	end = 0;
+	if(last >= 0) {
+		start = footer[first].offset;
+		end = footer[last].offset + footer[last].length;
+	}
+	clusterGIS_Count(CLUSTERGIS_STAT_BYTES_READ, end - start);
+	if(map) {
+		blocks = NULL;
+		if(end > start) {
+			fd = open(filename, O_RDONLY);
+			page = sysconf(_SC_PAGESIZE);
+			dataset->mapping_size = end - start + start % page;
+			dataset->mapping = fd < 0 ? MAP_FAILED : mmap(NULL, dataset->mapping_size, PROT_READ, MAP_PRIVATE, fd, start - start % page);
+			if(dataset->mapping == MAP_FAILED) {
+				fprintf(stderr, "%d: Error mapping file %s\n", comm_rank, filename);
+				MPI_Abort(comm, 1);
+			}
+			close(fd);
+			blocks = (char*) dataset->mapping + start % page;
+		}
+		MPI_File_close(&file);
+	} else {
+		blocks = clusterGIS_Arena_create_buffer(end - start);
+		clusterGIS_File_read_at_all(file, start, blocks, end - start);
+		MPI_File_close(&file);
+		blocks = clusterGIS_Arena_retain_buffer(&dataset->arena, blocks, end - start);
+	}
+
+	for(i = first; i <= last; i++) {
+		clusterGIS_Load_block(dataset, blocks + (footer[i].offset - start), &footer[i]);
+	}
+
+	free(owners);
+	free(footer);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_LOAD_TIME, timer);
+
+	return dataset;
+}
+
+/* clusterGIS_Load_block
+ *
+ * Adds the records of a block of a binary file to a dataset, their fields
+ * point into the block
+ *
+ * dataset - the dataset the records are added to
+ * block - the block in memory
+ * entry - the footer entry of the block
+ */
+static void clusterGIS_Load_block(clusterGIS_dataset* dataset, char* block, clusterGIS_binary_block* entry) {
+	struct clusterGIS_wkb_block wkb;
+	long long* sections;
+	long long* ends;
+	long long from;
+	int* counts;
+	int record;
+	int column;
+	int index;
+
+	sections = (long long*) block;
+	counts = (int*) (block + CLUSTERGIS_BINARY_ALIGN((entry->columns + 1) * (long long) sizeof(long long)));
+
+	wkb.dataset = dataset;
+	wkb.first = dataset->size;
+	for(record = 0; record < entry->records; record++) {
+		clusterGIS_Add_record(dataset, counts[record]);
+	}
+
+	for(column = 0; column < entry->columns; column++) {
+		ends = (long long*) (block + sections[column]);
+		from = 0;
+		for(record = 0; record < entry->records; record++) {
+			index = wkb.first + record;
+			if(column < counts[record]) {
+				clusterGIS_Get_field(dataset, index, column) = (char*) (ends + entry->records) + from;
+				clusterGIS_Get_length(dataset, index, column) = ends[record] - from - 1;
+			}
+			from = ends[record];
+		}
+	}
+
+	if(entry->geometry_column >= 0) {
+		dataset->geometry_column = entry->geometry_column;
+		wkb.ends = (long long*) (block + sections[entry->columns]);
+		wkb.wkb = (char*) (wkb.ends + entry->records);
+		clusterGIS_Parallel_for(entry->records, clusterGIS_Read_wkb_range, &wkb);
+	}
+}
+
+/* range function of clusterGIS_Load_block */
+static void clusterGIS_Read_wkb_range(clusterGIS_context* context, int start, int end, void* arg) {
+	struct clusterGIS_wkb_block* wkb = (struct clusterGIS_wkb_block*) arg;
+	long long from;
+	int i;
+
+	for(i = start; i < end; i++) {
+		from = i == 0 ? 0 : wkb->ends[i - 1];
+		if(wkb->ends[i] > from) {
+			wkb->dataset->geometries[wkb->first + i] = GEOSWKBReader_read_r(context->handle, context->wkb_reader, (unsigned char*) wkb->wkb + from, wkb->ends[i] - from);
+			clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, 1);
+		}
+	}
+}
@@ -0,0 +1,623 @@
+#include "clustergis.h"
+#include "clustergis_internal.h"
+#include "float.h"
+#include "string.h"
+
+/* predicate of clusterGIS_Filter_distance, next to the public ones */
+#define CLUSTERGIS_PREDICATE_DISTANCE -1
+
+/* state shared with the STRtree callbacks during a query */
+struct clusterGIS_query {
+	clusterGIS_context* context;
+	clusterGIS_dataset* dataset;
+	const GEOSGeometry* geometry;
+	int** results;
+	int* capacity;
+	int count;
+	int column;
+	char* value;
+	int length;
+	char* matches;
+	double distance;
+	int id_column;
+	int nearest;
+	int id;
+};
+
+/* state of a clusterGIS_Filter_geometry call, the query geometry is
+ * prepared once per thread */
+struct clusterGIS_filter {
+	clusterGIS_dataset* dataset;
+	const GEOSGeometry* geometry;
+	const GEOSPreparedGeometry** prepared;
+	clusterGIS_context** contexts;
+	double envelope[4];
+	double distance;
+	int predicate;
+	char* keep;
+};
+
+static void clusterGIS_Ignore_callback(void* item, void* userdata);
+static void clusterGIS_Envelope_range(clusterGIS_context* context, int start, int end, void* arg);
+static int clusterGIS_Filter(clusterGIS_dataset* dataset, GEOSGeometry* geometry, int predicate, double distance);
+static void clusterGIS_Filter_range(clusterGIS_context* context, int start, int end, void* arg);
+
+/* clusterGIS_Build_index
+ *
+ * Builds an STRtree over the geometries of a dataset, replacing any previous
+ * index. A dictionary encoded dataset also gets an STRtree over the
+ * geometries of each code, see clusterGIS_Encode_column. The index is
+ * dropped when the dataset's records change.
+ *
+ * dataset - the dataset to index, its geometries must have been created
+ */
+void clusterGIS_Build_index(clusterGIS_dataset* dataset) {
+	clusterGIS_dictionary* dictionary = &dataset->dictionary;
+	int first;
+	int code;
+	int record;
+	int i;
+
+	clusterGIS_Materialize_geometries(dataset);
+	clusterGIS_Free_index(dataset);
+
+	dataset->index = GEOSSTRtree_create_r(clusterGIS_geos.handle, 10);
+	first = -1;
+	for(i = 0; i < dataset->size; i++) {
+		if(dataset->geometries[i] != NULL) {
+			GEOSSTRtree_insert_r(clusterGIS_geos.handle, dataset->index, dataset->geometries[i], CLUSTERGIS_INDEX_ITEM(i));
+			if(first < 0) {
+				first = i;
+			}
+		}
+	}
+
+	/* the tree is built by its first query; do that now so threads can share it */
+	if(first >= 0) {
+		GEOSSTRtree_query_r(clusterGIS_geos.handle, dataset->index, dataset->geometries[first], clusterGIS_Ignore_callback, NULL);
+	}
+
+	if(dictionary->column < 0) {
+		return;
+	}
+	dictionary->indexes = calloc(dictionary->size + 1, sizeof(GEOSSTRtree*));
+	for(code = 0; code < dictionary->size; code++) {
+		first = -1;
+		for(i = dictionary->starts[code]; i < dictionary->starts[code + 1]; i++) {
+			record = dictionary->records[i];
+			if(dataset->geometries[record] == NULL) {
+				continue;
+			}
+			if(first < 0) {
+				dictionary->indexes[code] = GEOSSTRtree_create_r(clusterGIS_geos.handle, 10);
+				first = record;
+			}
+			GEOSSTRtree_insert_r(clusterGIS_geos.handle, dictionary->indexes[code], dataset->geometries[record], CLUSTERGIS_INDEX_ITEM(record));
+		}
+		if(first >= 0) {
+			GEOSSTRtree_query_r(clusterGIS_geos.handle, dictionary->indexes[code], dataset->geometries[first], clusterGIS_Ignore_callback, NULL);
+		}
+	}
+}
+
+/* clusterGIS_Free_index
+ *
+ * Frees the index of a dataset, if it has one
+ *
+ * dataset - the dataset whose index is freed
+ */
+void clusterGIS_Free_index(clusterGIS_dataset* dataset) {
+	int code;
+
+	if(dataset->index != NULL) {
+		GEOSSTRtree_destroy_r(clusterGIS_geos.handle, dataset->index);
+		dataset->index = NULL;
+	}
+	if(dataset->dictionary.indexes != NULL) {
+		for(code = 0; code < dataset->dictionary.size; code++) {
+			if(dataset->dictionary.indexes[code] != NULL) {
+				GEOSSTRtree_destroy_r(clusterGIS_geos.handle, dataset->dictionary.indexes[code]);
+			}
+		}
+		free(dataset->dictionary.indexes);
+		dataset->dictionary.indexes = NULL;
+	}
+}
+
+/* clusterGIS_Build_envelopes
+ *
+ * Caches the envelopes of the geometries of a dataset, replacing any
+ * previous ones. clusterGIS_Keep_records keeps them in step with the
+ * records; other changes to the records drop them. Envelopes of pending
+ * geometries are read from their WKT, see clusterGIS_Defer_wkt_geometries.
+ *
+ * dataset - the dataset, its geometries must have been created or deferred
+ */
+void clusterGIS_Build_envelopes(clusterGIS_dataset* dataset) {
+	clusterGIS_Free_envelopes(dataset);
+
+	dataset->envelopes.xmin = malloc(4 * (dataset->size + 1) * sizeof(double));
+	dataset->envelopes.ymin = dataset->envelopes.xmin + dataset->size;
+	dataset->envelopes.xmax = dataset->envelopes.ymin + dataset->size;
+	dataset->envelopes.ymax = dataset->envelopes.xmax + dataset->size;
+	dataset->envelopes.size = dataset->size;
+	clusterGIS_Parallel_for(dataset->size, clusterGIS_Envelope_range, dataset);
+}
+
+/* range function of clusterGIS_Build_envelopes */
+static void clusterGIS_Envelope_range(clusterGIS_context* context, int start, int end, void* arg) {
+	clusterGIS_dataset* dataset = (clusterGIS_dataset*) arg;
+	clusterGIS_envelopes* envelopes = &dataset->envelopes;
+	double envelope[4];
+	int i;
+
+	for(i = start; i < end; i++) {
+		if(dataset->pending != NULL && dataset->pending[i]) {
+			if(clusterGIS_Wkt_envelope(clusterGIS_Get_field(dataset, i, dataset->geometry_column), envelope)) {
+				envelopes->xmin[i] = envelope[0];
+				envelopes->ymin[i] = envelope[1];
+				envelopes->xmax[i] = envelope[2];
+				envelopes->ymax[i] = envelope[3];
+				continue;
+			}
+		}
+		if(dataset->geometries[i] == NULL || GEOSisEmpty_r(context->handle, dataset->geometries[i])) {
+			envelopes->xmin[i] = DBL_MAX;
+			envelopes->ymin[i] = DBL_MAX;
+			envelopes->xmax[i] = -DBL_MAX;
+			envelopes->ymax[i] = -DBL_MAX;
+			continue;
+		}
+		GEOSGeom_getXMin_r(context->handle, dataset->geometries[i], &envelopes->xmin[i]);
+		GEOSGeom_getYMin_r(context->handle, dataset->geometries[i], &envelopes->ymin[i]);
+		GEOSGeom_getXMax_r(context->handle, dataset->geometries[i], &envelopes->xmax[i]);
+		GEOSGeom_getYMax_r(context->handle, dataset->geometries[i], &envelopes->ymax[i]);
+	}
+}
+
+/* clusterGIS_Free_envelopes
+ *
+ * Frees the cached envelopes of a dataset, if it has them
+ *
+ * dataset - the dataset whose envelopes are freed
+ */
+void clusterGIS_Free_envelopes(clusterGIS_dataset* dataset) {
+	free(dataset->envelopes.xmin);
+	dataset->envelopes.xmin = NULL;
+	dataset->envelopes.size = 0;
+}
+
+/* clusterGIS_Add_result
+ *
+ * Appends a record index to the results of a query, growing them as needed
+ */
+static void clusterGIS_Add_result(struct clusterGIS_query* query, int record) {
+	if(query->count == *query->capacity) {
+		*query->capacity = *query->capacity == 0 ? 64 : *query->capacity * 2;
+		*query->results = realloc(*query->results, *query->capacity * sizeof(int));
+	}
+	(*query->results)[query->count] = record;
+	query->count++;
+}
+
+/* STRtree callback collecting every candidate */
+static void clusterGIS_Envelope_callback(void* item, void* userdata) {
+	clusterGIS_Add_result((struct clusterGIS_query*) userdata, CLUSTERGIS_INDEX_RECORD(item));
+}
+
+/* STRtree callback for queries which only build the tree */
+static void clusterGIS_Ignore_callback(void* item, void* userdata) {
+	(void) item;
+	(void) userdata;
+}
+
+/* range function marking the candidates which really intersect */
+static void clusterGIS_Intersects_range(clusterGIS_context* context, int start, int end, void* arg) {
+	struct clusterGIS_query* query = (struct clusterGIS_query*) arg;
+	int i;
+
+	for(i = start; i < end; i++) {
+		query->matches[i] = GEOSIntersects_r(context->handle, query->geometry, query->dataset->geometries[(*query->results)[i]]) == 1;
+	}
+	clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, end - start);
+}
+
+/* clusterGIS_Check_index
+ *
+ * Aborts when a query is made on a dataset without an index
+ */
+static void clusterGIS_Check_index(clusterGIS_dataset* dataset, char* function) {
+	if(dataset->index == NULL) {
+		fprintf(stderr, "%s: dataset has no index, see clusterGIS_Build_index\n", function);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+}
+
+/* clusterGIS_Query_intersects
+ *
+ * Finds the records whose geometries intersect a geometry
+ *
+ * dataset - an indexed dataset
+ * geometry - the geometry to test against
+ * results - array of record indexes, grown with realloc when needed
+ * capacity - number of entries *results has room for, updated when it grows
+ *
+ * Returns the number of records found
+ */
+int clusterGIS_Query_intersects(clusterGIS_dataset* dataset, GEOSGeometry* geometry, int** results, int* capacity) {
+	struct clusterGIS_query query;
+	int count;
+	int i;
+	double start;
+
+	clusterGIS_Check_index(dataset, "clusterGIS_Query_intersects");
+	start = clusterGIS_Start_timer();
+
+	/* collect the candidates whose envelopes intersect */
+	query.dataset = dataset;
+	query.geometry = geometry;
+	query.results = results;
+	query.capacity = capacity;
+	query.count = 0;
+	GEOSSTRtree_query_r(clusterGIS_geos.handle, dataset->index, geometry, clusterGIS_Envelope_callback, &query);
+
+	/* test the candidates exactly on all threads, then keep the matches in order */
+	query.matches = malloc(query.count + 1);
+	clusterGIS_Parallel_for(query.count, clusterGIS_Intersects_range, &query);
+	count = 0;
+	for(i = 0; i < query.count; i++) {
+		if(query.matches[i]) {
+			(*results)[count] = (*results)[i];
+			count++;
+		}
+	}
+	free(query.matches);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_PREDICATE_TIME, start);
+
+	return count;
+}
+
+/* clusterGIS_Query_envelope
+ *
+ * Finds the records whose envelopes intersect a rectangle
+ *
+ * dataset - an indexed dataset
+ * xmin, ymin, xmax, ymax - the rectangle
+ * results - array of record indexes, grown with realloc when needed
+ * capacity - number of entries *results has room for, updated when it grows
+ *
+ * Returns the number of records found
+ */
+int clusterGIS_Query_envelope(clusterGIS_dataset* dataset, double xmin, double ymin, double xmax, double ymax, int** results, int* capacity) {
+	struct clusterGIS_query query;
+	GEOSGeometry* rectangle;
+
+	clusterGIS_Check_index(dataset, "clusterGIS_Query_envelope");
+
+	rectangle = GEOSGeom_createRectangle_r(clusterGIS_geos.handle, xmin, ymin, xmax, ymax);
+	query.dataset = dataset;
+	query.geometry = rectangle;
+	query.results = results;
+	query.capacity = capacity;
+	query.count = 0;
+	GEOSSTRtree_query_r(clusterGIS_geos.handle, dataset->index, rectangle, clusterGIS_Envelope_callback, &query);
+	GEOSGeom_destroy_r(clusterGIS_geos.handle, rectangle);
+
+	return query.count;
+}
+
+/* STRtree callback measuring the distance from the query to a record.
+ * Records without the query's column, or whose field in it does not start
+ * with the query's value, are infinitely far. */
+static int clusterGIS_Distance_callback(const void* item1, const void* item2, double* distance, void* userdata) {
+	struct clusterGIS_query* query = (struct clusterGIS_query*) userdata;
+	const void* item = item1 == (void*) query ? item2 : item1;
+	int record = CLUSTERGIS_INDEX_RECORD(item);
+
+	if(query->column >= 0 && (query->column >= clusterGIS_Get_columns(query->dataset, record)
+		|| strncmp(clusterGIS_Get_field(query->dataset, record, query->column), query->value, query->length) != 0)) {
+		*distance = DBL_MAX;
+		return 1;
+	}
+
+	clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, 1);
+	return GEOSDistance_r(query->context->handle, query->geometry, query->dataset->geometries[record], distance);
+}
+
+/* STRtree callback keeping the record with the lowest id of those exactly
+ * as near to the query as the nearest record found */
+static void clusterGIS_Tie_callback(void* item, void* userdata) {
+	struct clusterGIS_query* query = (struct clusterGIS_query*) userdata;
+	int record = CLUSTERGIS_INDEX_RECORD(item);
+	double distance;
+	int id;
+
+	if(record == query->nearest || query->id_column >= clusterGIS_Get_columns(query->dataset, record)) {
+		return;
+	}
+	if(clusterGIS_Distance_callback(item, query, &distance, query) == 0 || distance != query->distance) {
+		return;
+	}
+	id = atoi(clusterGIS_Get_field(query->dataset, record, query->id_column));
+	if(id < query->id) {
+		query->id = id;
+		query->nearest = record;
+	}
+}
+
+/* clusterGIS_Query_nearest
+ *
+ * Finds the record nearest to a geometry, optionally only considering
+ * records whose field in a column starts with a given value. When the
+ * column is dictionary encoded and the value starts a single code's value,
+ * only the tree of that code is searched.
+ *
+ * dataset - an indexed dataset
+ * geometry - the geometry to measure from
+ * column - column to match value against, or -1 to consider every record
+ * value - the value the fields of records in column must start with
+ * distance - returned with the distance to the nearest record
+ *
+ * Returns the index of the nearest record, or -1 when there is none
+ */
+int clusterGIS_Query_nearest(clusterGIS_dataset* dataset, GEOSGeometry* geometry, int column, char* value, double* distance) {
+	return clusterGIS_Query_nearest_r(&clusterGIS_geos, dataset, geometry, column, value, distance);
+}
+
+/* clusterGIS_Query_nearest_r
+ *
+ * clusterGIS_Query_nearest using the given GEOS context, e.g. from a
+ * clusterGIS_Parallel_for range function
+ */
+int clusterGIS_Query_nearest_r(clusterGIS_context* context, clusterGIS_dataset* dataset, GEOSGeometry* geometry, int column, char* value, double* distance) {
+	return clusterGIS_Query_nearest_id_r(context, dataset, geometry, column, value, -1, distance);
+}
+
+/* clusterGIS_Query_nearest_id_r
+ *
+ * clusterGIS_Query_nearest_r breaking ties between equally near records on
+ * the lowest integer id, so the answer does not depend on the order of the
+ * tree or on how the records are distributed
+ *
+ * id_column - column of the dataset holding integer ids, or -1 to return
+ *             any of the equally near records
+ */
+int clusterGIS_Query_nearest_id_r(clusterGIS_context* context, clusterGIS_dataset* dataset, GEOSGeometry* geometry, int column, char* value, int id_column, double* distance) {
+	struct clusterGIS_query query;
+	clusterGIS_dictionary* dictionary = &dataset->dictionary;
+	GEOSSTRtree* index;
+	GEOSGeometry* window;
+	const void* item;
+	double bounds[4];
+	double margin;
+	int record;
+	int code;
+	int first;
+	int last;
+	int middle;
+
+	clusterGIS_Check_index(dataset, "clusterGIS_Query_nearest");
+
+	*distance = DBL_MAX;
+	if(dataset->size == 0) {
+		return -1;
+	}
+
+	query.context = context;
+	query.dataset = dataset;
+	query.geometry = geometry;
+	query.column = column;
+	query.value = value;
+	query.length = column >= 0 ? strlen(value) : 0;
+	index = dataset->index;
+
+	/* the codes whose values start with value are adjacent in sorted; when
+	 * there is only one every record in its tree matches */
+	if(column >= 0 && column == dictionary->column && dictionary->indexes != NULL) {
+		first = 0;
+		last = dictionary->size;
+		while(first < last) {
+			middle = (first + last) / 2;
+			if(strcmp(dictionary->values[dictionary->sorted[middle]], value) < 0) {
+				first = middle + 1;
+			} else {
+				last = middle;
+			}
+		}
+		last = first;
+		while(last < dictionary->size && strncmp(dictionary->values[dictionary->sorted[last]], value, query.length) == 0) {
+			last++;
+		}
+
+		if(last == first) {
+			return -1;
+		}
+		if(last == first + 1) {
+			code = dictionary->sorted[first];
+			if(dictionary->indexes[code] == NULL) {
+				return -1;
+			}
+			index = dictionary->indexes[code];
+			query.column = -1;
+		}
+	}
+
+	item = GEOSSTRtree_nearest_generic_r(context->handle, index, &query, geometry, clusterGIS_Distance_callback, &query);
+	if(item == NULL) {
+		return -1;
+	}
+
+	record = CLUSTERGIS_INDEX_RECORD(item);
+	clusterGIS_Distance_callback(item, &query, distance, &query);
+	if(*distance == DBL_MAX) {
+		return -1;
+	}
+
+	/* every record as near as the nearest has an envelope within distance of
+	 * the geometry's, the margin keeps rounding from losing one */
+	if(id_column >= 0 && id_column < clusterGIS_Get_columns(dataset, record)
+		&& GEOSGeom_getXMin_r(context->handle, geometry, &bounds[0])
+		&& GEOSGeom_getYMin_r(context->handle, geometry, &bounds[1])
+		&& GEOSGeom_getXMax_r(context->handle, geometry, &bounds[2])
+		&& GEOSGeom_getYMax_r(context->handle, geometry, &bounds[3])) {
+		margin = *distance * (1 + 1e-9) + 1e-12;
+		query.distance = *distance;
+		query.id_column = id_column;
+		query.nearest = record;
+		query.id = atoi(clusterGIS_Get_field(dataset, record, id_column));
+		window = GEOSGeom_createRectangle_r(context->handle, bounds[0] - margin, bounds[1] - margin, bounds[2] + margin, bounds[3] + margin);
+		GEOSSTRtree_query_r(context->handle, index, window, clusterGIS_Tie_callback, &query);
+		GEOSGeom_destroy_r(context->handle, window);
+		record = query.nearest;
+	}
+
+	return record;
+}
+
+/* clusterGIS_Filter_geometry
+ *
+ * Removes the records of a dataset whose geometries do not satisfy a
+ * predicate with a query geometry. The query geometry is prepared, and
+ * records are rejected by their cached envelopes before any exact test;
+ * the envelopes are built if the dataset has none.
+ *
+ * dataset - the dataset to filter, its geometries must have been created or
+ *           deferred, only those of candidates are then created
+ * geometry - the query geometry
+ * predicate - CLUSTERGIS_PREDICATE_INTERSECTS keeps records intersecting
+ *             geometry, _CONTAINS those geometry contains, _COVERS those
+ *             geometry covers and _WITHIN those geometry lies within
+ *
+ * Returns the number of records kept
+ */
+int clusterGIS_Filter_geometry(clusterGIS_dataset* dataset, GEOSGeometry* geometry, int predicate) {
+	return clusterGIS_Filter(dataset, geometry, predicate, 0);
+}
+
+/* clusterGIS_Filter_distance
+ *
+ * Removes the records of a dataset whose geometries are further than a
+ * distance from a query geometry, see clusterGIS_Filter_geometry
+ *
+ * dataset - the dataset to filter, its geometries must have been created or
+ *           deferred
+ * geometry - the query geometry
+ * distance - the largest distance of the records kept
+ *
+ * Returns the number of records kept
+ */
+int clusterGIS_Filter_distance(clusterGIS_dataset* dataset, GEOSGeometry* geometry, double distance) {
+	return clusterGIS_Filter(dataset, geometry, CLUSTERGIS_PREDICATE_DISTANCE, distance);
+}
+
+/* clusterGIS_Filter
+ *
+ * Filters a dataset for clusterGIS_Filter_geometry and
+ * clusterGIS_Filter_distance
+ */
+static int clusterGIS_Filter(clusterGIS_dataset* dataset, GEOSGeometry* geometry, int predicate, double distance) {
+	struct clusterGIS_filter filter;
+	int threads;
+	int kept;
+	int i;
+	double start;
+
+	start = clusterGIS_Start_timer();
+	if(dataset->envelopes.xmin == NULL || dataset->envelopes.size != dataset->size) {
+		clusterGIS_Build_envelopes(dataset);
+	}
+
+	threads = clusterGIS_Get_threads();
+	filter.dataset = dataset;
+	filter.geometry = geometry;
+	filter.predicate = predicate;
+	filter.distance = distance;
+	filter.prepared = calloc(threads, sizeof(GEOSPreparedGeometry*));
+	filter.contexts = calloc(threads, sizeof(clusterGIS_context*));
+	filter.keep = malloc(dataset->size + 1);
+	GEOSGeom_getXMin_r(clusterGIS_geos.handle, geometry, &filter.envelope[0]);
+	GEOSGeom_getYMin_r(clusterGIS_geos.handle, geometry, &filter.envelope[1]);
+	GEOSGeom_getXMax_r(clusterGIS_geos.handle, geometry, &filter.envelope[2]);
+	GEOSGeom_getYMax_r(clusterGIS_geos.handle, geometry, &filter.envelope[3]);
+
+	clusterGIS_Parallel_for(dataset->size, clusterGIS_Filter_range, &filter);
+	kept = clusterGIS_Keep_records(dataset, filter.keep);
+
+	for(i = 0; i < threads; i++) {
+		if(filter.prepared[i] != NULL) {
+			GEOSPreparedGeom_destroy_r(filter.contexts[i]->handle, filter.prepared[i]);
+		}
+	}
+	free(filter.prepared);
+	free(filter.contexts);
+	free(filter.keep);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_PREDICATE_TIME, start);
+
+	return kept;
+}
+
+/* range function of clusterGIS_Filter_geometry */
+static void clusterGIS_Filter_range(clusterGIS_context* context, int start, int end, void* arg) {
+	struct clusterGIS_filter* filter = (struct clusterGIS_filter*) arg;
+	clusterGIS_envelopes* envelopes = &filter->dataset->envelopes;
+	const GEOSPreparedGeometry* prepared;
+	GEOSGeometry* geometry;
+	double* envelope = filter->envelope;
+	long long calls;
+	int i;
+
+	calls = 0;
+	if(filter->prepared[context->thread] == NULL) {
+		filter->prepared[context->thread] = GEOSPrepare_r(context->handle, filter->geometry);
+		filter->contexts[context->thread] = context;
+		calls++;
+	}
+	prepared = filter->prepared[context->thread];
+
+	/* a match must be near or overlap the query envelope, and lie inside or around it */
+	if(filter->predicate == CLUSTERGIS_PREDICATE_DISTANCE) {
+		clusterGIS_Envelopes_distance(envelopes, start, end, envelope, filter->distance, filter->keep + start);
+	} else {
+		clusterGIS_Envelopes_window(envelopes, start, end, envelope, filter->keep + start);
+	}
+
+	for(i = start; i < end; i++) {
+		if(!filter->keep[i]) {
+			continue;
+		}
+		if((filter->predicate == CLUSTERGIS_PREDICATE_CONTAINS || filter->predicate == CLUSTERGIS_PREDICATE_COVERS) && (envelopes->xmin[i] < envelope[0] || envelopes->xmax[i] > envelope[2] || envelopes->ymin[i] < envelope[1] || envelopes->ymax[i] > envelope[3])) {
+			filter->keep[i] = 0;
+			continue;
+		}
+		if(filter->predicate == CLUSTERGIS_PREDICATE_WITHIN && (envelopes->xmin[i] > envelope[0] || envelopes->xmax[i] < envelope[2] || envelopes->ymin[i] > envelope[1] || envelopes->ymax[i] < envelope[3])) {
+			filter->keep[i] = 0;
+			continue;
+		}
+
+		/* a field which is not valid WKT has no geometry to test */
+		geometry = clusterGIS_Materialize_geometry_r(context, filter->dataset, i);
+		if(geometry == NULL) {
+			filter->keep[i] = 0;
+			continue;
+		}
+		calls++;
+		switch(filter->predicate) {
+			case CLUSTERGIS_PREDICATE_DISTANCE:
+				filter->keep[i] = GEOSPreparedDistanceWithin_r(context->handle, prepared, geometry, filter->distance) == 1;
+				break;
+			case CLUSTERGIS_PREDICATE_CONTAINS:
+				filter->keep[i] = GEOSPreparedContains_r(context->handle, prepared, geometry) == 1;
+				break;
+			case CLUSTERGIS_PREDICATE_COVERS:
+				filter->keep[i] = GEOSPreparedCovers_r(context->handle, prepared, geometry) == 1;
+				break;
+			case CLUSTERGIS_PREDICATE_WITHIN:
+				filter->keep[i] = GEOSPreparedWithin_r(context->handle, prepared, geometry) == 1;
+				break;
+			default:
+				filter->keep[i] = GEOSPreparedIntersects_r(context->handle, prepared, geometry) == 1;
+				break;
+		}
+	}
+	clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, calls);
+}
@@ -0,0 +1,49 @@
+#ifndef CLUSTERGIS_INTERNAL_H
+#define CLUSTERGIS_INTERNAL_H
+
+/* functions shared between the clusterGIS source files, not part of the API */
+
+#include "clustergis.h"
+#include "stdint.h"
+
+/* STRtree items are record indexes, offset by one so no item is NULL */
+#define CLUSTERGIS_INDEX_ITEM(record) ((void*) (intptr_t) ((record) + 1))
+#define CLUSTERGIS_INDEX_RECORD(item) ((int) ((intptr_t) (item) - 1))
+
+/* record operations */
+int clusterGIS_Parse_csv_record(clusterGIS_dataset* dataset, char* csv, int* start);
+void clusterGIS_Add_csv_records(clusterGIS_dataset* dataset, char* buffer, int start, int end, clusterGIS_load_options* options);
+size_t clusterGIS_Csv_record_length(clusterGIS_dataset* dataset, int record);
+size_t clusterGIS_Format_csv_record(char* buffer, clusterGIS_dataset* dataset, int record);
+
+/* dataset operations */
+void clusterGIS_Replace_dataset(clusterGIS_dataset* dataset, clusterGIS_dataset* replacement);
+int clusterGIS_Add_record(clusterGIS_dataset* dataset, int columns);
+void clusterGIS_Order_records(clusterGIS_dataset* dataset, int* order);
+clusterGIS_dataset* clusterGIS_Send_records(MPI_Comm comm, clusterGIS_dataset* dataset, int* counts, int* destinations);
+void clusterGIS_Publish_extents(MPI_Comm comm, clusterGIS_dataset* dataset);
+unsigned int clusterGIS_Hash(const char* value, int length);
+
+/* geometry operations */
+void clusterGIS_Create_context(clusterGIS_context* context);
+void clusterGIS_Free_context(clusterGIS_context* context);
+int clusterGIS_Get_envelope(clusterGIS_dataset* dataset, int record, double* envelope);
+int clusterGIS_Query_nearest_id_r(clusterGIS_context* context, clusterGIS_dataset* dataset, GEOSGeometry* geometry, int column, char* value, int id_column, double* distance);
+
+/* file operations */
+void clusterGIS_File_write_at_all(MPI_File file, long long offset, char* buffer, long long size);
+void clusterGIS_File_read_at_all(MPI_File file, long long offset, char* buffer, long long size);
+
+/* statistics operations, see clusterGIS_stats */
+extern clusterGIS_stats clusterGIS_statistics;
+#define clusterGIS_Count(stat, amount) __sync_fetch_and_add(&clusterGIS_statistics.values[(stat)], (long long) (amount))
+double clusterGIS_Start_timer(void);
+void clusterGIS_Stop_timer(int stat, double start);
+
+/* arena operations */
+char* clusterGIS_Arena_create_buffer(size_t size);
+char* clusterGIS_Arena_retain_buffer(clusterGIS_arena* arena, char* buffer, size_t size);
+void clusterGIS_Arena_free_buffer(char* buffer);
+char* clusterGIS_Arena_grow_buffer(char* buffer, size_t size);
+
+#endif
@@ -0,0 +1,372 @@
+#include "clustergis.h"
+#include "clustergis_internal.h"
+#include "string.h"
+#include "float.h"
+
+/* left records whose minima are reduced together */
+#define CLUSTERGIS_JOIN_BATCH 65536
+
+/* element of an MPI_DOUBLE_INT vector, reduced with MPI_MINLOC */
+struct clusterGIS_distance_id {
+	double distance;
+	int id;
+};
+
+/* a batch of left records to find the local nearest right records for */
+struct clusterGIS_nearest_batch {
+	clusterGIS_dataset* left;
+	clusterGIS_dataset* right;
+	int first;
+	int right_id_column;
+	int match_column;
+	struct clusterGIS_distance_id* minima;
+};
+
+/* clusterGIS_Local_nearest
+ *
+ * Range function finding the nearest right record on this task for left
+ * records first + start to first + end - 1 of a batch
+ */
+static void clusterGIS_Local_nearest(clusterGIS_context* context, int start, int end, void* arg) {
+	struct clusterGIS_nearest_batch* batch = (struct clusterGIS_nearest_batch*) arg;
+	struct clusterGIS_distance_id* minimum;
+	GEOSGeometry* geometry;
+	int record;
+	int nearest;
+	char* value;
+	int i;
+
+	for(i = start; i < end; i++) {
+		record = batch->first + i;
+		minimum = &batch->minima[i];
+		geometry = clusterGIS_Materialize_geometry_r(context, batch->left, record);
+		value = batch->match_column >= 0 ? clusterGIS_Get_field(batch->left, record, batch->match_column) : NULL;
+		nearest = -1;
+		minimum->distance = DBL_MAX;
+		if(geometry != NULL) {
+			nearest = clusterGIS_Query_nearest_id_r(context, batch->right, geometry, batch->match_column, value, batch->right_id_column, &minimum->distance);
+			clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, 1);
+		}
+		minimum->id = nearest < 0 ? -1 : atoi(clusterGIS_Get_field(batch->right, nearest, batch->right_id_column));
+	}
+}
+
+/* clusterGIS_Nearest_join
+ *
+ * Finds the nearest right record for every left record. Every task in comm
+ * holds the same left records and a part of the right records. The local
+ * minima of a batch of left records are merged across comm by a single
+ * MPI_MINLOC reduction of (distance, id) pairs, overlapped with finding the
+ * local minima of the next batch on all threads. Equally near right records
+ * are told apart by the lowest id, both on a task and by MPI_MINLOC, so the
+ * result does not depend on the number of tasks.
+ *
+ * left - dataset with geometries, the same on every task in comm
+ * right - dataset with geometries, distributed over comm; it is encoded on
+ *         match_column, see clusterGIS_Encode_column, and indexed if it
+ *         has no index yet
+ * comm - MPI communicator over which right is distributed
+ * left_id_column - column of left copied to the output
+ * right_id_column - column of right holding integer ids
+ * match_column - column of both records, a right record only matches when
+ *                its field starts with the left record's field, e.g. a left
+ *                "R" matches right "R" and "R1", or -1 to consider every
+ *                right record
+ *
+ * Returns a dataset with a record "left id","right id" per left record, the
+ * same on every task in comm. The right id is -1 when no right record matches.
+ */
+clusterGIS_dataset* clusterGIS_Nearest_join(clusterGIS_dataset* left, clusterGIS_dataset* right, MPI_Comm comm, int left_id_column, int right_id_column, int match_column) {
+	clusterGIS_dataset* output;
+	struct clusterGIS_distance_id* minima[2];
+	struct clusterGIS_distance_id* global;
+	struct clusterGIS_nearest_batch search;
+	MPI_Request request;
+	int batch;
+	int batches;
+	int first;
+	int count;
+	int record;
+	char* line;
+	int start;
+	double timer;
+	double wait;
+
+	timer = clusterGIS_Start_timer();
+	if(match_column >= 0 && right->dictionary.column != match_column) {
+		clusterGIS_Encode_column(right, match_column);
+	}
+	if(right->index == NULL) {
+		clusterGIS_Build_index(right);
+	}
+
+	minima[0] = malloc(CLUSTERGIS_JOIN_BATCH * sizeof(struct clusterGIS_distance_id));
+	minima[1] = malloc(CLUSTERGIS_JOIN_BATCH * sizeof(struct clusterGIS_distance_id));
+	global = malloc((left->size + 1) * sizeof(struct clusterGIS_distance_id));
+
+	/* reduce each batch while the next one is searched locally */
+	search.left = left;
+	search.right = right;
+	search.right_id_column = right_id_column;
+	search.match_column = match_column;
+	batches = (left->size + CLUSTERGIS_JOIN_BATCH - 1) / CLUSTERGIS_JOIN_BATCH;
+	request = MPI_REQUEST_NULL;
+	for(batch = 0; batch < batches; batch++) {
+		first = batch * CLUSTERGIS_JOIN_BATCH;
+		count = left->size - first < CLUSTERGIS_JOIN_BATCH ? left->size - first : CLUSTERGIS_JOIN_BATCH;
+
+		search.first = first;
+		search.minima = minima[batch % 2];
+		clusterGIS_Parallel_for(count, clusterGIS_Local_nearest, &search);
+
+		wait = clusterGIS_Start_timer();
+		MPI_Wait(&request, MPI_STATUS_IGNORE);
+		clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, wait);
+		MPI_Iallreduce(minima[batch % 2], &global[first], count, MPI_DOUBLE_INT, MPI_MINLOC, comm, &request);
+	}
+	wait = clusterGIS_Start_timer();
+	MPI_Wait(&request, MPI_STATUS_IGNORE);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, wait);
+
+	/* build the output dataset */
+	output = clusterGIS_Create_dataset();
+	for(record = 0; record < left->size; record++) {
+		line = clusterGIS_Arena_alloc(&output->arena, clusterGIS_Get_length(left, record, left_id_column) + 20);
+		sprintf(line, "\"%s\",\"%d\"\n", clusterGIS_Get_field(left, record, left_id_column), global[record].id);
+		start = 0;
+		clusterGIS_Parse_csv_record(output, line, &start);
+	}
+
+	free(minima[0]);
+	free(minima[1]);
+	free(global);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_PREDICATE_TIME, timer);
+
+	return output;
+}
+
+/* a pair of records found by clusterGIS_Spatial_join */
+struct clusterGIS_join_pair {
+	int left;
+	int right;
+};
+
+/* the pairs found by one thread */
+struct clusterGIS_join_pairs {
+	struct clusterGIS_join_pair* pairs;
+	int count;
+	int capacity;
+};
+
+/* state of a clusterGIS_Spatial_join on one task */
+struct clusterGIS_spatial_join {
+	clusterGIS_dataset* left;
+	clusterGIS_dataset* right;
+	int predicate;
+	struct clusterGIS_join_pairs* found;
+};
+
+/* state of the STRtree query for one left record */
+struct clusterGIS_join_probe {
+	clusterGIS_context* context;
+	struct clusterGIS_spatial_join* join;
+	const GEOSPreparedGeometry* prepared;
+	int left;
+	long long calls;
+};
+
+/* STRtree callback testing a candidate right record exactly */
+static void clusterGIS_Join_callback(void* item, void* userdata) {
+	struct clusterGIS_join_probe* probe = (struct clusterGIS_join_probe*) userdata;
+	struct clusterGIS_join_pairs* found = &probe->join->found[probe->context->thread];
+	GEOSContextHandle_t handle = probe->context->handle;
+	GEOSGeometry* geometry;
+	int right;
+	char match;
+
+	right = CLUSTERGIS_INDEX_RECORD(item);
+	geometry = probe->join->right->geometries[right];
+	probe->calls++;
+	switch(probe->join->predicate) {
+		case CLUSTERGIS_PREDICATE_CONTAINS:
+			match = GEOSPreparedContains_r(handle, probe->prepared, geometry);
+			break;
+		case CLUSTERGIS_PREDICATE_COVERS:
+			match = GEOSPreparedCovers_r(handle, probe->prepared, geometry);
+			break;
+		case CLUSTERGIS_PREDICATE_WITHIN:
+			match = GEOSPreparedWithin_r(handle, probe->prepared, geometry);
+			break;
+		default:
+			match = GEOSPreparedIntersects_r(handle, probe->prepared, geometry);
+			break;
+	}
+	if(match != 1) {
+		return;
+	}
+
+	if(found->count == found->capacity) {
+		found->capacity = found->capacity == 0 ? 1024 : found->capacity * 2;
+		found->pairs = realloc(found->pairs, found->capacity * sizeof(struct clusterGIS_join_pair));
+	}
+	found->pairs[found->count].left = probe->left;
+	found->pairs[found->count].right = right;
+	found->count++;
+}
+
+/* range function probing the local right records with left records */
+static void clusterGIS_Join_range(clusterGIS_context* context, int start, int end, void* arg) {
+	struct clusterGIS_spatial_join* join = (struct clusterGIS_spatial_join*) arg;
+	struct clusterGIS_join_probe probe;
+	GEOSGeometry* geometry;
+	int i;
+
+	probe.context = context;
+	probe.join = join;
+	probe.calls = 0;
+	for(i = start; i < end; i++) {
+		geometry = clusterGIS_Materialize_geometry_r(context, join->left, i);
+		if(geometry == NULL || GEOSisEmpty_r(context->handle, geometry)) {
+			continue;
+		}
+		probe.prepared = GEOSPrepare_r(context->handle, geometry);
+		probe.left = i;
+		GEOSSTRtree_query_r(context->handle, join->right->index, geometry, clusterGIS_Join_callback, &probe);
+		GEOSPreparedGeom_destroy_r(context->handle, probe.prepared);
+		probe.calls += 2;
+	}
+	clusterGIS_Count(CLUSTERGIS_STAT_GEOS_CALLS, probe.calls);
+}
+
+static int clusterGIS_Compare_pairs(const void* a, const void* b) {
+	const struct clusterGIS_join_pair* x = (const struct clusterGIS_join_pair*) a;
+	const struct clusterGIS_join_pair* y = (const struct clusterGIS_join_pair*) b;
+
+	if(x->left != y->left) {
+		return (x->left > y->left) - (x->left < y->left);
+	}
+	return (x->right > y->right) - (x->right < y->right);
+}
+
+/* clusterGIS_Spatial_join
+ *
+ * Finds the pairs of left and right records whose geometries satisfy a
+ * predicate, with both datasets distributed over comm. right is
+ * repartitioned spatially, unless it already was over comm, and indexed.
+ * Every left record is sent to the tasks whose right extents its envelope
+ * overlaps, where it is prepared and tested against the right records the
+ * index finds. Each right record lives on one task, so each pair is found
+ * once. The extents of a right dataset which was already partitioned are
+ * published again first, as records may have been added or changed since.
+ *
+ * comm - MPI communicator over which both datasets are distributed
+ * left - dataset with geometries, created or deferred
+ * right - dataset with geometries, it may be repartitioned and indexed
+ * left_id_column - column of left copied to the output
+ * right_id_column - column of right copied to the output
+ * predicate - CLUSTERGIS_PREDICATE_INTERSECTS pairs records which
+ *             intersect, _CONTAINS and _COVERS those where the left geometry
+ *             contains or covers the right one, _WITHIN those where it lies
+ *             within the right one, e.g. points in polygons
+ *
+ * Returns a distributed dataset with a record "left id","right id" per pair
+ */
+clusterGIS_dataset* clusterGIS_Spatial_join(MPI_Comm comm, clusterGIS_dataset* left, clusterGIS_dataset* right, int left_id_column, int right_id_column, int predicate) {
+	struct clusterGIS_spatial_join join;
+	struct clusterGIS_join_pair* pairs;
+	clusterGIS_dataset* output;
+	double envelope[4];
+	int* counts;
+	int* destinations;
+	int* ranks;
+	size_t capacity;
+	int comm_size;
+	int threads;
+	size_t total;
+	int record;
+	int count;
+	int i;
+	char* line;
+	char* left_id;
+	char* right_id;
+	int start;
+	double timer;
+
+	timer = clusterGIS_Start_timer();
+	MPI_Comm_size(comm, &comm_size);
+
+	if(right->extents == NULL || right->extents_count != comm_size) {
+		clusterGIS_Repartition_spatial(comm, right);
+	} else {
+		clusterGIS_Publish_extents(comm, right);
+	}
+	if(right->index == NULL) {
+		clusterGIS_Build_index(right);
+	}
+
+	/* send each left record to every task it may find partners on */
+	counts = malloc((left->size + 1) * sizeof(int));
+	ranks = malloc(comm_size * sizeof(int));
+	capacity = (size_t) left->size + comm_size;
+	destinations = malloc(capacity * sizeof(int));
+	total = 0;
+	for(record = 0; record < left->size; record++) {
+		counts[record] = 0;
+		if(clusterGIS_Get_envelope(left, record, envelope)) {
+			counts[record] = clusterGIS_Overlapping_ranks(right, envelope[0], envelope[1], envelope[2], envelope[3], ranks);
+		}
+		if(total + counts[record] > capacity) {
+			capacity *= 2;
+			destinations = realloc(destinations, capacity * sizeof(int));
+			if(destinations == NULL) {
+				fprintf(stderr, "clusterGIS_Spatial_join: out of memory for %lu destinations\n", (unsigned long) capacity);
+				MPI_Abort(comm, 1);
+			}
+		}
+		memcpy(destinations + total, ranks, counts[record] * sizeof(int));
+		total += counts[record];
+	}
+	join.left = clusterGIS_Send_records(comm, left, counts, destinations);
+	free(counts);
+	free(ranks);
+	free(destinations);
+
+	/* probe the local index on all threads */
+	threads = clusterGIS_Get_threads();
+	join.right = right;
+	join.predicate = predicate;
+	join.found = calloc(threads, sizeof(struct clusterGIS_join_pairs));
+	clusterGIS_Parallel_for(join.left->size, clusterGIS_Join_range, &join);
+
+	/* gather the pairs of all threads in a stable order */
+	count = 0;
+	for(i = 0; i < threads; i++) {
+		count += join.found[i].count;
+	}
+	pairs = malloc((count + 1) * sizeof(struct clusterGIS_join_pair));
+	count = 0;
+	for(i = 0; i < threads; i++) {
+		memcpy(pairs + count, join.found[i].pairs, join.found[i].count * sizeof(struct clusterGIS_join_pair));
+		count += join.found[i].count;
+		free(join.found[i].pairs);
+	}
+	free(join.found);
+	qsort(pairs, count, sizeof(struct clusterGIS_join_pair), clusterGIS_Compare_pairs);
+
+	/* build the output dataset */
+	output = clusterGIS_Create_dataset();
+	for(i = 0; i < count; i++) {
+		left_id = clusterGIS_Get_field(join.left, pairs[i].left, left_id_column);
+		right_id = clusterGIS_Get_field(right, pairs[i].right, right_id_column);
+		line = clusterGIS_Arena_alloc(&output->arena, strlen(left_id) + strlen(right_id) + 8);
+		sprintf(line, "\"%s\",\"%s\"\n", left_id, right_id);
+		start = 0;
+		clusterGIS_Parse_csv_record(output, line, &start);
+	}
+
+	free(pairs);
+	clusterGIS_Free_dataset(join.left);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_PREDICATE_TIME, timer);
+
+	return output;
+}
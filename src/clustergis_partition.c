@@ -0,0 +1,636 @@
+#include "clustergis.h"
+#include "clustergis_internal.h"
+#include "string.h"
+#include "float.h"
+#include "limits.h"
+
+/* Hilbert curve grid is 2^16 cells on a side, so keys fit in 32 bits */
+#define CLUSTERGIS_HILBERT_ORDER 16
+/* keys each task contributes when choosing splitters */
+#define CLUSTERGIS_SAMPLES_PER_TASK 32
+
+/* sort key of a record, see clusterGIS_Sort */
+struct clusterGIS_sort_key {
+	const char* string;
+	long long integer;
+	double number;
+	int record;
+};
+
+/* clusterGIS_Exchange_records
+ *
+ * Sends every record of a distributed dataset to the task chosen for it with
+ * a single MPI_Alltoallv, see clusterGIS_Send_records
+ *
+ * comm - MPI communicator of the participants of the distributed dataset
+ * dataset - the dataset, its contents are replaced by the records received
+ * destinations - rank in comm each record is sent to
+ */
+void clusterGIS_Exchange_records(MPI_Comm comm, clusterGIS_dataset* dataset, int* destinations) {
+	clusterGIS_Replace_dataset(dataset, clusterGIS_Send_records(comm, dataset, NULL, destinations));
+}
+
+/* clusterGIS_Send_records
+ *
+ * Sends copies of the records of a distributed dataset to the tasks chosen
+ * for them with a single MPI_Alltoallv. Records travel as csv lines and are
+ * split in place in the receive buffer, which the new dataset retains.
+ * Geometries are recreated, or deferred, on the receiving task if the
+ * dataset had them.
+ *
+ * comm - MPI communicator of the participants of the distributed dataset
+ * dataset - the dataset, it is not changed
+ * counts - number of tasks each record is sent to, or NULL to send every
+ *          record to one task
+ * destinations - ranks in comm the records are sent to, counts[0] ranks for
+ *                the first record followed by those of the next
+ *
+ * Returns a dataset of the records received
+ */
+clusterGIS_dataset* clusterGIS_Send_records(MPI_Comm comm, clusterGIS_dataset* dataset, int* counts, int* destinations) {
+	int comm_size;
+	int* sendcounts;
+	int* sdispls;
+	int* recvcounts;
+	int* rdispls;
+	int* positions;
+	long long* sendsizes;
+	long long total;
+	size_t length;
+	char* sendbuffer;
+	char* recvbuffer;
+	clusterGIS_dataset* received;
+	double start;
+	int record;
+	int copies;
+	int copy;
+	int next;
+	int i;
+
+	MPI_Comm_size(comm, &comm_size);
+
+	/* count the bytes going to each task */
+	sendsizes = calloc(comm_size, sizeof(long long));
+	next = 0;
+	for(record = 0; record < dataset->size; record++) {
+		copies = counts != NULL ? counts[record] : 1;
+		if(copies > 0) {
+			length = clusterGIS_Csv_record_length(dataset, record);
+			for(copy = 0; copy < copies; copy++) {
+				sendsizes[destinations[next + copy]] += length;
+			}
+		}
+		next += copies;
+	}
+
+	sendcounts = malloc(comm_size * sizeof(int));
+	sdispls = malloc(comm_size * sizeof(int));
+	positions = malloc(comm_size * sizeof(int));
+	total = 0;
+	for(i = 0; i < comm_size; i++) {
+		if(total + sendsizes[i] > INT_MAX) {
+			fprintf(stderr, "clusterGIS_Send_records: more than %d bytes to send\n", INT_MAX);
+			MPI_Abort(comm, 1);
+		}
+		sendcounts[i] = sendsizes[i];
+		sdispls[i] = total;
+		positions[i] = total;
+		total += sendsizes[i];
+	}
+
+	/* pack the records by destination */
+	sendbuffer = malloc(total + 1);
+	next = 0;
+	for(record = 0; record < dataset->size; record++) {
+		copies = counts != NULL ? counts[record] : 1;
+		for(copy = 0; copy < copies; copy++) {
+			i = destinations[next + copy];
+			positions[i] += clusterGIS_Format_csv_record(sendbuffer + positions[i], dataset, record);
+		}
+		next += copies;
+	}
+
+	recvcounts = malloc(comm_size * sizeof(int));
+	rdispls = malloc(comm_size * sizeof(int));
+	start = clusterGIS_Start_timer();
+	MPI_Alltoall(sendcounts, 1, MPI_INT, recvcounts, 1, MPI_INT, comm);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, start);
+	total = 0;
+	for(i = 0; i < comm_size; i++) {
+		if(total + recvcounts[i] > INT_MAX) {
+			fprintf(stderr, "clusterGIS_Send_records: more than %d bytes to receive\n", INT_MAX);
+			MPI_Abort(comm, 1);
+		}
+		rdispls[i] = total;
+		total += recvcounts[i];
+	}
+
+	recvbuffer = clusterGIS_Arena_create_buffer(total);
+	start = clusterGIS_Start_timer();
+	MPI_Alltoallv(sendbuffer, sendcounts, sdispls, MPI_CHAR, recvbuffer, recvcounts, rdispls, MPI_CHAR, comm);
+	clusterGIS_Stop_timer(CLUSTERGIS_STAT_MPI_WAIT_TIME, start);
+
+	/* split the received records in place */
+	received = clusterGIS_Create_dataset();
+	recvbuffer = clusterGIS_Arena_retain_buffer(&received->arena, recvbuffer, total);
+	i = 0;
+	while(i < total) {
+		clusterGIS_Parse_csv_record(received, recvbuffer, &i);
+		i++;
+	}
+	if(dataset->pending != NULL) {
+		clusterGIS_Defer_wkt_geometries(received, dataset->geometry_column);
+	} else if(dataset->geometry_column >= 0) {
+		clusterGIS_Create_wkt_geometries(received, dataset->geometry_column);
+	}
+	if(dataset->dictionary.column >= 0) {
+		clusterGIS_Encode_column(received, dataset->dictionary.column);
+	}
+
+	free(sendsizes);
+	free(sendcounts);
+	free(sdispls);
+	free(positions);
+	free(sendbuffer);
+	free(recvcounts);
+	free(rdispls);
+
+	return received;
+}
+
+/* clusterGIS_Hilbert_key
+ *
+ * Returns the distance along a Hilbert curve of the cell at x, y
+ */
+static unsigned int clusterGIS_Hilbert_key(unsigned int x, unsigned int y) {
+	unsigned int n = 1u << CLUSTERGIS_HILBERT_ORDER;
+	unsigned int rx;
+	unsigned int ry;
+	unsigned int s;
+	unsigned int t;
+	unsigned int key = 0;
+
+	for(s = n / 2; s > 0; s /= 2) {
+		rx = (x & s) > 0;
+		ry = (y & s) > 0;
+		key += s * s * ((3 * rx) ^ ry);
+
+		/* rotate the quadrant so the curve stays continuous */
+		if(ry == 0) {
+			if(rx == 1) {
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			t = x;
+			x = y;
+			y = t;
+		}
+	}
+
+	return key;
+}
+
+static int clusterGIS_Compare_keys(const void* a, const void* b) {
+	unsigned int x = *(const unsigned int*) a;
+	unsigned int y = *(const unsigned int*) b;
+
+	return (x > y) - (x < y);
+}
+
+/* clusterGIS_Publish_extents
+ *
+ * Shares the extent of each task's records with every task in comm, see
+ * clusterGIS_Overlapping_ranks
+ *
+ * comm - MPI communicator of the participants of the distributed dataset
+ * dataset - the dataset, the extents are stored in it
+ */
+void clusterGIS_Publish_extents(MPI_Comm comm, clusterGIS_dataset* dataset) {
+	int comm_size;
+	double extent[4];
+	double envelope[4];
+	int record;
+
+	MPI_Comm_size(comm, &comm_size);
+
+	/* an empty extent has min > max and overlaps nothing */
+	extent[0] = DBL_MAX;
+	extent[1] = DBL_MAX;
+	extent[2] = -DBL_MAX;
+	extent[3] = -DBL_MAX;
+	for(record = 0; record < dataset->size; record++) {
+		if(clusterGIS_Get_envelope(dataset, record, envelope)) {
+			if(envelope[0] < extent[0]) extent[0] = envelope[0];
+			if(envelope[1] < extent[1]) extent[1] = envelope[1];
+			if(envelope[2] > extent[2]) extent[2] = envelope[2];
+			if(envelope[3] > extent[3]) extent[3] = envelope[3];
+		}
+	}
+
+	free(dataset->extents);
+	dataset->extents = malloc(4 * comm_size * sizeof(double));
+	dataset->extents_count = comm_size;
+	MPI_Allgather(extent, 4, MPI_DOUBLE, dataset->extents, 4, MPI_DOUBLE, comm);
+}
+
+/* clusterGIS_Repartition_spatial
+ *
+ * Redistributes a dataset so each task owns a compact region. Records are
+ * ordered along a Hilbert curve through the centres of their envelopes, the
+ * curve is cut into equal sized pieces using a sample of the keys, and the
+ * records are moved with a single MPI_Alltoallv. Afterwards the extent of
+ * every task is published in the dataset.
+ *
+ * comm - MPI communicator of the participants of the distributed dataset
+ * dataset - the dataset to repartition, its geometries must have been created
+ */
+void clusterGIS_Repartition_spatial(MPI_Comm comm, clusterGIS_dataset* dataset) {
+	int comm_size;
+	double local[4];
+	double global[4];
+	double envelope[4];
+	double xscale;
+	double yscale;
+	double cells;
+	unsigned int* keys;
+	unsigned int* sorted;
+	unsigned int* samples;
+	unsigned int* all_samples;
+	unsigned int* splitters;
+	int* sample_counts;
+	int* sample_displs;
+	int sample_count;
+	int total_samples;
+	int* destinations;
+	int record;
+	int low;
+	int high;
+	int middle;
+	int i;
+
+	MPI_Comm_size(comm, &comm_size);
+
+	if(dataset->geometry_column < 0) {
+		fprintf(stderr, "clusterGIS_Repartition_spatial: dataset has no geometries\n");
+		MPI_Abort(comm, 1);
+	}
+
+	/* find the extent of the whole dataset, maxima are negated to use one reduction */
+	local[0] = DBL_MAX;
+	local[1] = DBL_MAX;
+	local[2] = DBL_MAX;
+	local[3] = DBL_MAX;
+	for(record = 0; record < dataset->size; record++) {
+		if(clusterGIS_Get_envelope(dataset, record, envelope)) {
+			if(envelope[0] < local[0]) local[0] = envelope[0];
+			if(envelope[1] < local[1]) local[1] = envelope[1];
+			if(-envelope[2] < local[2]) local[2] = -envelope[2];
+			if(-envelope[3] < local[3]) local[3] = -envelope[3];
+		}
+	}
+	MPI_Allreduce(local, global, 4, MPI_DOUBLE, MPI_MIN, comm);
+	global[2] = -global[2];
+	global[3] = -global[3];
+
+	/* key every record by the Hilbert cell of its envelope's centre */
+	cells = (double) ((1u << CLUSTERGIS_HILBERT_ORDER) - 1);
+	xscale = global[2] > global[0] ? cells / (global[2] - global[0]) : 0;
+	yscale = global[3] > global[1] ? cells / (global[3] - global[1]) : 0;
+	keys = malloc((dataset->size + 1) * sizeof(unsigned int));
+	for(record = 0; record < dataset->size; record++) {
+		keys[record] = 0;
+		if(clusterGIS_Get_envelope(dataset, record, envelope)) {
+			keys[record] = clusterGIS_Hilbert_key(
+				(unsigned int) (((envelope[0] + envelope[2]) / 2 - global[0]) * xscale),
+				(unsigned int) (((envelope[1] + envelope[3]) / 2 - global[1]) * yscale));
+		}
+	}
+
+	/* choose splitters from a regular sample of every task's keys */
+	sorted = malloc((dataset->size + 1) * sizeof(unsigned int));
+	memcpy(sorted, keys, dataset->size * sizeof(unsigned int));
+	qsort(sorted, dataset->size, sizeof(unsigned int), clusterGIS_Compare_keys);
+	sample_count = dataset->size < CLUSTERGIS_SAMPLES_PER_TASK ? dataset->size : CLUSTERGIS_SAMPLES_PER_TASK;
+	samples = malloc((sample_count + 1) * sizeof(unsigned int));
+	for(i = 0; i < sample_count; i++) {
+		samples[i] = sorted[(long long) i * dataset->size / sample_count];
+	}
+
+	sample_counts = malloc(comm_size * sizeof(int));
+	sample_displs = malloc(comm_size * sizeof(int));
+	MPI_Allgather(&sample_count, 1, MPI_INT, sample_counts, 1, MPI_INT, comm);
+	total_samples = 0;
+	for(i = 0; i < comm_size; i++) {
+		sample_displs[i] = total_samples;
+		total_samples += sample_counts[i];
+	}
+	all_samples = malloc((total_samples + 1) * sizeof(unsigned int));
+	MPI_Allgatherv(samples, sample_count, MPI_UNSIGNED, all_samples, sample_counts, sample_displs, MPI_UNSIGNED, comm);
+	qsort(all_samples, total_samples, sizeof(unsigned int), clusterGIS_Compare_keys);
+
+	splitters = malloc(comm_size * sizeof(unsigned int));
+	for(i = 1; i < comm_size; i++) {
+		splitters[i - 1] = total_samples > 0 ? all_samples[(long long) i * total_samples / comm_size] : 0;
+	}
+
+	/* records go to the task whose piece of the curve holds their key */
+	destinations = malloc((dataset->size + 1) * sizeof(int));
+	for(record = 0; record < dataset->size; record++) {
+		low = 0;
+		high = comm_size - 1;
+		while(low < high) {
+			middle = (low + high) / 2;
+			if(keys[record] < splitters[middle]) {
+				high = middle;
+			} else {
+				low = middle + 1;
+			}
+		}
+		destinations[record] = low;
+	}
+
+	clusterGIS_Exchange_records(comm, dataset, destinations);
+	clusterGIS_Publish_extents(comm, dataset);
+
+	free(keys);
+	free(sorted);
+	free(samples);
+	free(sample_counts);
+	free(sample_displs);
+	free(all_samples);
+	free(splitters);
+	free(destinations);
+}
+
+/* clusterGIS_Repartition_by_key
+ *
+ * Redistributes a dataset so all records with the same value in a column
+ * are on one task, the task hash(value) % size. The records are moved with
+ * a single MPI_Alltoallv, see clusterGIS_Exchange_records. Records with
+ * equal keys can then be matched, merged or updated locally.
+ *
+ * comm - MPI communicator of the participants of the distributed dataset
+ * dataset - the dataset to repartition
+ * column - the key column, records without it have the key ""
+ */
+void clusterGIS_Repartition_by_key(MPI_Comm comm, clusterGIS_dataset* dataset, int column) {
+	int comm_size;
+	int* destinations;
+	int record;
+
+	MPI_Comm_size(comm, &comm_size);
+
+	destinations = malloc((dataset->size + 1) * sizeof(int));
+	for(record = 0; record < dataset->size; record++) {
+		if(column < clusterGIS_Get_columns(dataset, record)) {
+			destinations[record] = clusterGIS_Hash(clusterGIS_Get_field(dataset, record, column), clusterGIS_Get_length(dataset, record, column)) % comm_size;
+		} else {
+			destinations[record] = clusterGIS_Hash("", 0) % comm_size;
+		}
+	}
+
+	clusterGIS_Exchange_records(comm, dataset, destinations);
+
+	free(destinations);
+}
+
+/* clusterGIS_Overlapping_ranks
+ *
+ * Finds the tasks whose records may intersect a rectangle, using the extents
+ * published by clusterGIS_Repartition_spatial
+ *
+ * dataset - a spatially partitioned dataset
+ * xmin, ymin, xmax, ymax - the rectangle
+ * ranks - returned with the ranks, must have room for every task
+ *
+ * Returns the number of ranks found
+ */
+int clusterGIS_Overlapping_ranks(clusterGIS_dataset* dataset, double xmin, double ymin, double xmax, double ymax, int* ranks) {
+	double* extent;
+	int count;
+	int rank;
+
+	if(dataset->extents == NULL) {
+		fprintf(stderr, "clusterGIS_Overlapping_ranks: dataset has no extents, see clusterGIS_Repartition_spatial\n");
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	count = 0;
+	for(rank = 0; rank < dataset->extents_count; rank++) {
+		extent = &dataset->extents[4 * rank];
+		if(extent[0] <= xmax && extent[2] >= xmin && extent[1] <= ymax && extent[3] >= ymin) {
+			ranks[count] = rank;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/* clusterGIS_Make_sort_key
+ *
+ * Fills in the sort key of a field
+ *
+ * key - the key to fill in
+ * field - the field, it must outlive the key
+ * type - CLUSTERGIS_SORT_STRING, _INTEGER or _NUMBER
+ * record - the record of the field, which breaks ties between equal keys
+ */
+static void clusterGIS_Make_sort_key(struct clusterGIS_sort_key* key, const char* field, int type, int record) {
+	key->string = field;
+	key->integer = type == CLUSTERGIS_SORT_INTEGER ? strtoll(field, NULL, 10) : 0;
+	key->number = type == CLUSTERGIS_SORT_NUMBER ? strtod(field, NULL) : 0;
+	key->record = record;
+}
+
+static int clusterGIS_Compare_strings(const void* a, const void* b) {
+	const struct clusterGIS_sort_key* x = (const struct clusterGIS_sort_key*) a;
+	const struct clusterGIS_sort_key* y = (const struct clusterGIS_sort_key*) b;
+	int order;
+
+	order = strcmp(x->string, y->string);
+	if(order != 0) {
+		return order;
+	}
+	return (x->record > y->record) - (x->record < y->record);
+}
+
+static int clusterGIS_Compare_integers(const void* a, const void* b) {
+	const struct clusterGIS_sort_key* x = (const struct clusterGIS_sort_key*) a;
+	const struct clusterGIS_sort_key* y = (const struct clusterGIS_sort_key*) b;
+
+	if(x->integer != y->integer) {
+		return (x->integer > y->integer) - (x->integer < y->integer);
+	}
+	return (x->record > y->record) - (x->record < y->record);
+}
+
+static int clusterGIS_Compare_numbers(const void* a, const void* b) {
+	const struct clusterGIS_sort_key* x = (const struct clusterGIS_sort_key*) a;
+	const struct clusterGIS_sort_key* y = (const struct clusterGIS_sort_key*) b;
+
+	if(x->number != y->number) {
+		return (x->number > y->number) - (x->number < y->number);
+	}
+	return (x->record > y->record) - (x->record < y->record);
+}
+
+/* clusterGIS_Sort_keys
+ *
+ * Keys the records of a dataset by a column and sorts the keys
+ *
+ * dataset - the dataset
+ * column - the column to sort by, records without it have the key ""
+ * type - CLUSTERGIS_SORT_STRING, _INTEGER or _NUMBER
+ * compare - comparison function of type
+ *
+ * Returns the sorted keys
+ */
+static struct clusterGIS_sort_key* clusterGIS_Sort_keys(clusterGIS_dataset* dataset, int column, int type, int (*compare)(const void*, const void*)) {
+	struct clusterGIS_sort_key* keys;
+	int record;
+
+	keys = malloc((dataset->size + 1) * sizeof(struct clusterGIS_sort_key));
+	for(record = 0; record < dataset->size; record++) {
+		clusterGIS_Make_sort_key(&keys[record], column < clusterGIS_Get_columns(dataset, record) ? clusterGIS_Get_field(dataset, record, column) : "", type, record);
+	}
+	qsort(keys, dataset->size, sizeof(struct clusterGIS_sort_key), compare);
+
+	return keys;
+}
+
+/* clusterGIS_Sort
+ *
+ * Sorts a distributed dataset by a column with a sample sort, so that the
+ * records of each task are in order and come before those of the next
+ * task; clusterGIS_Write_csv_distributed then writes a sorted file. Every
+ * task contributes a regular sample of its sorted keys, the samples choose
+ * a splitter between each pair of tasks, the records are moved with a
+ * single MPI_Alltoallv and each task sorts the records it received. The
+ * sort is stable. Records with equal keys stay on one task, so a column
+ * with few distinct values leaves the tasks unevenly loaded.
+ *
+ * comm - MPI communicator of the participants of the distributed dataset
+ * dataset - the dataset to sort
+ * column - the column to sort by, records without it have the key ""
+ * type - CLUSTERGIS_SORT_STRING compares the fields as strings,
+ *        _INTEGER as integers and _NUMBER as floating point numbers
+ */
+void clusterGIS_Sort(MPI_Comm comm, clusterGIS_dataset* dataset, int column, int type) {
+	int (*compare)(const void*, const void*);
+	int comm_size;
+	struct clusterGIS_sort_key* keys;
+	struct clusterGIS_sort_key* sorted_samples;
+	struct clusterGIS_sort_key* splitters;
+	char* samples;
+	char* all_samples;
+	const char* field;
+	int* sample_sizes;
+	int* sample_displs;
+	int sample_count;
+	int sample_size;
+	int total_samples;
+	int total_size;
+	int position;
+	int* destinations;
+	int* order;
+	int record;
+	int low;
+	int high;
+	int middle;
+	int i;
+
+	MPI_Comm_size(comm, &comm_size);
+
+	if(type == CLUSTERGIS_SORT_STRING) {
+		compare = clusterGIS_Compare_strings;
+	} else if(type == CLUSTERGIS_SORT_INTEGER) {
+		compare = clusterGIS_Compare_integers;
+	} else if(type == CLUSTERGIS_SORT_NUMBER) {
+		compare = clusterGIS_Compare_numbers;
+	} else {
+		fprintf(stderr, "clusterGIS_Sort: unknown key type %d\n", type);
+		MPI_Abort(comm, 1);
+		return;
+	}
+
+	/* the samples travel as the null terminated fields they were keyed from */
+	keys = clusterGIS_Sort_keys(dataset, column, type, compare);
+	sample_count = dataset->size < CLUSTERGIS_SAMPLES_PER_TASK ? dataset->size : CLUSTERGIS_SAMPLES_PER_TASK;
+	sample_size = 0;
+	for(i = 0; i < sample_count; i++) {
+		sample_size += strlen(keys[(long long) i * dataset->size / sample_count].string) + 1;
+	}
+	samples = malloc(sample_size + 1);
+	sample_size = 0;
+	for(i = 0; i < sample_count; i++) {
+		field = keys[(long long) i * dataset->size / sample_count].string;
+		strcpy(samples + sample_size, field);
+		sample_size += strlen(field) + 1;
+	}
+
+	sample_sizes = malloc(comm_size * sizeof(int));
+	sample_displs = malloc(comm_size * sizeof(int));
+	MPI_Allgather(&sample_size, 1, MPI_INT, sample_sizes, 1, MPI_INT, comm);
+	total_size = 0;
+	for(i = 0; i < comm_size; i++) {
+		sample_displs[i] = total_size;
+		total_size += sample_sizes[i];
+	}
+	all_samples = malloc(total_size + 1);
+	MPI_Allgatherv(samples, sample_size, MPI_CHAR, all_samples, sample_sizes, sample_displs, MPI_CHAR, comm);
+
+	/* splitters have record -1, so records equal to one go to the task above it */
+	total_samples = 0;
+	for(i = 0; i < total_size; i++) {
+		total_samples += all_samples[i] == '\0';
+	}
+	sorted_samples = malloc((total_samples + 1) * sizeof(struct clusterGIS_sort_key));
+	position = 0;
+	for(i = 0; i < total_samples; i++) {
+		clusterGIS_Make_sort_key(&sorted_samples[i], all_samples + position, type, -1);
+		position += strlen(all_samples + position) + 1;
+	}
+	qsort(sorted_samples, total_samples, sizeof(struct clusterGIS_sort_key), compare);
+	splitters = malloc(comm_size * sizeof(struct clusterGIS_sort_key));
+	for(i = 1; i < comm_size && total_samples > 0; i++) {
+		splitters[i - 1] = sorted_samples[(long long) i * total_samples / comm_size];
+	}
+
+	/* records go to the task between whose splitters their key falls */
+	destinations = malloc((dataset->size + 1) * sizeof(int));
+	for(i = 0; i < dataset->size; i++) {
+		low = 0;
+		high = total_samples > 0 ? comm_size - 1 : 0;
+		while(low < high) {
+			middle = (low + high) / 2;
+			if(compare(&keys[i], &splitters[middle]) < 0) {
+				high = middle;
+			} else {
+				low = middle + 1;
+			}
+		}
+		destinations[keys[i].record] = low;
+	}
+	free(keys);
+
+	/* records arrive in rank order and in order from each rank, so sorting by
+	 * key and then arrival keeps the sort stable */
+	clusterGIS_Exchange_records(comm, dataset, destinations);
+	keys = clusterGIS_Sort_keys(dataset, column, type, compare);
+	order = malloc((dataset->size + 1) * sizeof(int));
+	for(record = 0; record < dataset->size; record++) {
+		order[record] = keys[record].record;
+	}
+	clusterGIS_Order_records(dataset, order);
+
+	free(keys);
+	free(samples);
+	free(sample_sizes);
+	free(sample_displs);
+	free(all_samples);
+	free(sorted_samples);
+	free(splitters);
+	free(destinations);
+	free(order);
+}
@@ -0,0 +1,250 @@
+#include "clustergis.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CLUSTERGIS_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* The envelope kernels test a run of envelopes against a query window four
+ * (AVX2) or two (SSE2) at a time, with a scalar loop for the rest and for
+ * other targets. On x86-64 the AVX2 kernels are compiled for AVX2 whatever
+ * the build flags and only used when the processor has it, SSE2 is part of
+ * x86-64 itself. */
+
+/* the instruction set the kernels use, -1 until it is first needed */
+static int clusterGIS_simd = -1;
+
+/* clusterGIS_Supported_simd
+ *
+ * Returns the best CLUSTERGIS_SIMD_* level the processor supports
+ */
+static int clusterGIS_Supported_simd(void) {
+#if defined(CLUSTERGIS_SIMD_X86)
+	if(__builtin_cpu_supports("avx2")) {
+		return CLUSTERGIS_SIMD_AVX2;
+	}
+	return CLUSTERGIS_SIMD_SSE2;
+#else
+	return CLUSTERGIS_SIMD_SCALAR;
+#endif
+}
+
+/* clusterGIS_Set_simd
+ *
+ * Sets the instruction set the envelope kernels use, e.g. to compare them
+ * with the scalar kernels. By default they use the best one available.
+ *
+ * simd - CLUSTERGIS_SIMD_SCALAR, _SSE2 or _AVX2, lowered to the best level
+ *        the processor supports
+ */
+void clusterGIS_Set_simd(int simd) {
+	int supported = clusterGIS_Supported_simd();
+
+	clusterGIS_simd = simd < CLUSTERGIS_SIMD_SCALAR ? CLUSTERGIS_SIMD_SCALAR : simd > supported ? supported : simd;
+}
+
+/* clusterGIS_Get_simd
+ *
+ * Returns the CLUSTERGIS_SIMD_* level the envelope kernels use
+ */
+int clusterGIS_Get_simd(void) {
+	if(clusterGIS_simd < 0) {
+		clusterGIS_simd = clusterGIS_Supported_simd();
+	}
+	return clusterGIS_simd;
+}
+
+#if defined(CLUSTERGIS_SIMD_X86)
+/* AVX2 part of clusterGIS_Envelopes_window, returns where it stopped */
+__attribute__((target("avx2")))
+static int clusterGIS_Envelopes_window_avx2(clusterGIS_envelopes* envelopes, int start, int end, double* window, char* matches, int* count) {
+	__m256d wxmin = _mm256_set1_pd(window[0]);
+	__m256d wymin = _mm256_set1_pd(window[1]);
+	__m256d wxmax = _mm256_set1_pd(window[2]);
+	__m256d wymax = _mm256_set1_pd(window[3]);
+	__m256d in;
+	int mask;
+	int i = start;
+	int j;
+
+	for(; i + 4 <= end; i += 4) {
+		in = _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(&envelopes->xmin[i]), wxmax, _CMP_LE_OQ), _mm256_cmp_pd(_mm256_loadu_pd(&envelopes->xmax[i]), wxmin, _CMP_GE_OQ));
+		in = _mm256_and_pd(in, _mm256_cmp_pd(_mm256_loadu_pd(&envelopes->ymin[i]), wymax, _CMP_LE_OQ));
+		in = _mm256_and_pd(in, _mm256_cmp_pd(_mm256_loadu_pd(&envelopes->ymax[i]), wymin, _CMP_GE_OQ));
+		mask = _mm256_movemask_pd(in);
+		for(j = 0; j < 4; j++) {
+			matches[i - start + j] = (mask >> j) & 1;
+		}
+		*count += __builtin_popcount(mask);
+	}
+
+	return i;
+}
+
+/* SSE2 part of clusterGIS_Envelopes_window, returns where it stopped */
+static int clusterGIS_Envelopes_window_sse2(clusterGIS_envelopes* envelopes, int start, int end, double* window, char* matches, int* count) {
+	__m128d wxmin = _mm_set1_pd(window[0]);
+	__m128d wymin = _mm_set1_pd(window[1]);
+	__m128d wxmax = _mm_set1_pd(window[2]);
+	__m128d wymax = _mm_set1_pd(window[3]);
+	__m128d in;
+	int mask;
+	int i = start;
+	int j;
+
+	for(; i + 2 <= end; i += 2) {
+		in = _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(&envelopes->xmin[i]), wxmax), _mm_cmpge_pd(_mm_loadu_pd(&envelopes->xmax[i]), wxmin));
+		in = _mm_and_pd(in, _mm_cmple_pd(_mm_loadu_pd(&envelopes->ymin[i]), wymax));
+		in = _mm_and_pd(in, _mm_cmpge_pd(_mm_loadu_pd(&envelopes->ymax[i]), wymin));
+		mask = _mm_movemask_pd(in);
+		for(j = 0; j < 2; j++) {
+			matches[i - start + j] = (mask >> j) & 1;
+		}
+		*count += (mask & 1) + (mask >> 1);
+	}
+
+	return i;
+}
+#endif
+
+/* clusterGIS_Envelopes_window
+ *
+ * Tests which envelopes overlap a window
+ *
+ * envelopes - the envelopes, e.g. those of a dataset from
+ *             clusterGIS_Build_envelopes
+ * start - first envelope to test
+ * end - one past the last envelope to test
+ * window - xmin, ymin, xmax, ymax of the window
+ * matches - set to 1 for the envelopes which overlap, 0 for the others,
+ *           indexed from start
+ *
+ * Returns the number of envelopes which overlap
+ */
+int clusterGIS_Envelopes_window(clusterGIS_envelopes* envelopes, int start, int end, double* window, char* matches) {
+	int count = 0;
+	int mask;
+	int i = start;
+
+#if defined(CLUSTERGIS_SIMD_X86)
+	if(clusterGIS_Get_simd() == CLUSTERGIS_SIMD_AVX2) {
+		i = clusterGIS_Envelopes_window_avx2(envelopes, start, end, window, matches, &count);
+	} else if(clusterGIS_Get_simd() == CLUSTERGIS_SIMD_SSE2) {
+		i = clusterGIS_Envelopes_window_sse2(envelopes, start, end, window, matches, &count);
+	}
+#endif
+
+	for(; i < end; i++) {
+		mask = envelopes->xmin[i] <= window[2] && envelopes->xmax[i] >= window[0] && envelopes->ymin[i] <= window[3] && envelopes->ymax[i] >= window[1];
+		matches[i - start] = mask;
+		count += mask;
+	}
+
+	return count;
+}
+
+#if defined(CLUSTERGIS_SIMD_X86)
+/* AVX2 part of clusterGIS_Envelopes_distance, returns where it stopped */
+__attribute__((target("avx2")))
+static int clusterGIS_Envelopes_distance_avx2(clusterGIS_envelopes* envelopes, int start, int end, double* window, double limit, char* matches, int* count) {
+	__m256d wxmin = _mm256_set1_pd(window[0]);
+	__m256d wymin = _mm256_set1_pd(window[1]);
+	__m256d wxmax = _mm256_set1_pd(window[2]);
+	__m256d wymax = _mm256_set1_pd(window[3]);
+	__m256d zero = _mm256_setzero_pd();
+	__m256d limits = _mm256_set1_pd(limit);
+	__m256d vdx;
+	__m256d vdy;
+	int mask;
+	int i = start;
+	int j;
+
+	for(; i + 4 <= end; i += 4) {
+		/* the gap between the boxes along each axis, 0 where they overlap */
+		vdx = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(wxmin, _mm256_loadu_pd(&envelopes->xmax[i])), _mm256_sub_pd(_mm256_loadu_pd(&envelopes->xmin[i]), wxmax)), zero);
+		vdy = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(wymin, _mm256_loadu_pd(&envelopes->ymax[i])), _mm256_sub_pd(_mm256_loadu_pd(&envelopes->ymin[i]), wymax)), zero);
+		mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(vdx, vdx), _mm256_mul_pd(vdy, vdy)), limits, _CMP_LE_OQ));
+		for(j = 0; j < 4; j++) {
+			matches[i - start + j] = (mask >> j) & 1;
+		}
+		*count += __builtin_popcount(mask);
+	}
+
+	return i;
+}
+
+/* SSE2 part of clusterGIS_Envelopes_distance, returns where it stopped */
+static int clusterGIS_Envelopes_distance_sse2(clusterGIS_envelopes* envelopes, int start, int end, double* window, double limit, char* matches, int* count) {
+	__m128d wxmin = _mm_set1_pd(window[0]);
+	__m128d wymin = _mm_set1_pd(window[1]);
+	__m128d wxmax = _mm_set1_pd(window[2]);
+	__m128d wymax = _mm_set1_pd(window[3]);
+	__m128d zero = _mm_setzero_pd();
+	__m128d limits = _mm_set1_pd(limit);
+	__m128d vdx;
+	__m128d vdy;
+	int mask;
+	int i = start;
+	int j;
+
+	for(; i + 2 <= end; i += 2) {
+		/* the gap between the boxes along each axis, 0 where they overlap */
+		vdx = _mm_max_pd(_mm_max_pd(_mm_sub_pd(wxmin, _mm_loadu_pd(&envelopes->xmax[i])), _mm_sub_pd(_mm_loadu_pd(&envelopes->xmin[i]), wxmax)), zero);
+		vdy = _mm_max_pd(_mm_max_pd(_mm_sub_pd(wymin, _mm_loadu_pd(&envelopes->ymax[i])), _mm_sub_pd(_mm_loadu_pd(&envelopes->ymin[i]), wymax)), zero);
+		mask = _mm_movemask_pd(_mm_cmple_pd(_mm_add_pd(_mm_mul_pd(vdx, vdx), _mm_mul_pd(vdy, vdy)), limits));
+		for(j = 0; j < 2; j++) {
+			matches[i - start + j] = (mask >> j) & 1;
+		}
+		*count += (mask & 1) + (mask >> 1);
+	}
+
+	return i;
+}
+#endif
+
+/* clusterGIS_Envelopes_distance
+ *
+ * Tests which envelopes are within a distance of a window, a lower bound
+ * on the distance between the geometries they belong to
+ *
+ * envelopes - the envelopes
+ * start - first envelope to test
+ * end - one past the last envelope to test
+ * window - xmin, ymin, xmax, ymax of the window, e.g. the envelope of a
+ *          query geometry
+ * distance - the largest distance
+ * matches - set to 1 for the envelopes within distance, 0 for the others,
+ *           indexed from start
+ *
+ * Returns the number of envelopes within distance
+ */
+int clusterGIS_Envelopes_distance(clusterGIS_envelopes* envelopes, int start, int end, double* window, double distance, char* matches) {
+	double limit = distance * distance;
+	double dx;
+	double dy;
+	int count = 0;
+	int mask;
+	int i = start;
+
+#if defined(CLUSTERGIS_SIMD_X86)
+	if(clusterGIS_Get_simd() == CLUSTERGIS_SIMD_AVX2) {
+		i = clusterGIS_Envelopes_distance_avx2(envelopes, start, end, window, limit, matches, &count);
+	} else if(clusterGIS_Get_simd() == CLUSTERGIS_SIMD_SSE2) {
+		i = clusterGIS_Envelopes_distance_sse2(envelopes, start, end, window, limit, matches, &count);
+	}
+#endif
+
+	for(; i < end; i++) {
+		dx = window[0] - envelopes->xmax[i];
+		if(envelopes->xmin[i] - window[2] > dx) dx = envelopes->xmin[i] - window[2];
+		if(dx < 0) dx = 0;
+		dy = window[1] - envelopes->ymax[i];
+		if(envelopes->ymin[i] - window[3] > dy) dy = envelopes->ymin[i] - window[3];
+		if(dy < 0) dy = 0;
+		mask = dx * dx + dy * dy <= limit;
+		matches[i - start] = mask;
+		count += mask;
+	}
+
+	return count;
+}
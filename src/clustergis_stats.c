@@ -0,0 +1,110 @@
+#include "clustergis.h"
+#include "clustergis_internal.h"
+
+/* counters of this task, updated atomically so pool threads can share them */
+clusterGIS_stats clusterGIS_statistics;
+
+/* names of the statistics in reports, by CLUSTERGIS_STAT_* index */
+static const char* clusterGIS_stat_names[CLUSTERGIS_STATS] = {
+	"bytes read",
+	"records parsed",
+	"fields parsed",
+	"GEOS calls",
+	"bytes allocated",
+	"load time",
+	"geometry time",
+	"predicate time",
+	"write time",
+	"MPI wait time"
+};
+
+/* clusterGIS_Reset_stats
+ *
+ * Sets every statistic of this task back to 0
+ */
+void clusterGIS_Reset_stats(void) {
+	int i;
+
+	for(i = 0; i < CLUSTERGIS_STATS; i++) {
+		__sync_lock_test_and_set(&clusterGIS_statistics.values[i], 0);
+	}
+}
+
+/* clusterGIS_Get_stats
+ *
+ * Copies the statistics of this task
+ *
+ * stats - returned with the statistics
+ */
+void clusterGIS_Get_stats(clusterGIS_stats* stats) {
+	int i;
+
+	for(i = 0; i < CLUSTERGIS_STATS; i++) {
+		stats->values[i] = __sync_fetch_and_add(&clusterGIS_statistics.values[i], 0);
+	}
+}
+
+/* clusterGIS_Report_stats
+ *
+ * Prints the least, mean and greatest value of every statistic over the
+ * tasks in comm on its rank 0. The ratio of the greatest value to the mean
+ * shows how unevenly the work is spread; a straggler has a large ratio on
+ * its times. Times are printed in seconds.
+ *
+ * comm - MPI communicator of the tasks to report on
+ */
+void clusterGIS_Report_stats(MPI_Comm comm) {
+	clusterGIS_stats local;
+	long long minimum[CLUSTERGIS_STATS];
+	long long maximum[CLUSTERGIS_STATS];
+	long long sum[CLUSTERGIS_STATS];
+	double scale;
+	double mean;
+	int comm_rank;
+	int comm_size;
+	int i;
+
+	MPI_Comm_rank(comm, &comm_rank);
+	MPI_Comm_size(comm, &comm_size);
+
+	clusterGIS_Get_stats(&local);
+	MPI_Reduce(local.values, minimum, CLUSTERGIS_STATS, MPI_LONG_LONG, MPI_MIN, 0, comm);
+	MPI_Reduce(local.values, maximum, CLUSTERGIS_STATS, MPI_LONG_LONG, MPI_MAX, 0, comm);
+	MPI_Reduce(local.values, sum, CLUSTERGIS_STATS, MPI_LONG_LONG, MPI_SUM, 0, comm);
+
+	if(comm_rank != 0) {
+		return;
+	}
+
+	printf("%-16s %16s %16s %16s %9s\n", "statistic", "min", "mean", "max", "max/mean");
+	for(i = 0; i < CLUSTERGIS_STATS; i++) {
+		/* times are kept in nanoseconds */
+		scale = i >= CLUSTERGIS_STAT_LOAD_TIME ? 1e-9 : 1;
+		mean = (double) sum[i] / comm_size;
+		printf("%-16s %16.*f %16.*f %16.*f %9.2f\n", clusterGIS_stat_names[i],
+			scale < 1 ? 6 : 0, minimum[i] * scale,
+			scale < 1 ? 6 : 1, mean * scale,
+			scale < 1 ? 6 : 0, maximum[i] * scale,
+			mean > 0 ? maximum[i] / mean : 0);
+	}
+	fflush(stdout);
+}
+
+/* clusterGIS_Start_timer
+ *
+ * Returns the start time of a timed phase, see clusterGIS_Stop_timer
+ */
+double clusterGIS_Start_timer(void) {
+	return MPI_Wtime();
+}
+
+/* clusterGIS_Stop_timer
+ *
+ * Adds the time since a phase started to a time statistic
+ *
+ * stat - the CLUSTERGIS_STAT_*_TIME statistic
+ * start - the time from clusterGIS_Start_timer
+ */
+void clusterGIS_Stop_timer(int stat, double start) {
+	clusterGIS_Count(stat, (MPI_Wtime() - start) * 1e9);
+}
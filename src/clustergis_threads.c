@@ -0,0 +1,248 @@
+#include "clustergis.h"
+#include "clustergis_internal.h"
+#include "pthread.h"
+
+/* a thread of the pool and the part of the current loop it still owns */
+struct clusterGIS_worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int next;
+	int end;
+	clusterGIS_context* context;
+	clusterGIS_context own_context;
+	int generation;
+};
+
+/* the pool, worker 0 is the thread which calls clusterGIS_Parallel_for */
+static struct {
+	int threads;
+	struct clusterGIS_worker* workers;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	int generation;
+	int running;
+	int shutdown;
+	int grain;
+	clusterGIS_range_function function;
+	void* arg;
+} clusterGIS_pool = { 1, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 1, NULL, NULL };
+
+/* clusterGIS_Steal
+ *
+ * Takes the back half of the range of the worker with the most work left
+ *
+ * Returns 0 if no worker has more than a grain left
+ */
+static int clusterGIS_Steal(struct clusterGIS_worker* self) {
+	struct clusterGIS_worker* victim;
+	int remaining;
+	int middle;
+	int end;
+	int i;
+
+	/* find a victim */
+	victim = NULL;
+	remaining = clusterGIS_pool.grain;
+	for(i = 0; i < clusterGIS_pool.threads; i++) {
+		if(&clusterGIS_pool.workers[i] == self) {
+			continue;
+		}
+		pthread_mutex_lock(&clusterGIS_pool.workers[i].lock);
+		if(clusterGIS_pool.workers[i].end - clusterGIS_pool.workers[i].next > remaining) {
+			remaining = clusterGIS_pool.workers[i].end - clusterGIS_pool.workers[i].next;
+			victim = &clusterGIS_pool.workers[i];
+		}
+		pthread_mutex_unlock(&clusterGIS_pool.workers[i].lock);
+	}
+	if(victim == NULL) {
+		return 0;
+	}
+
+	/* take the back half, the victim may have moved on since it was chosen */
+	pthread_mutex_lock(&victim->lock);
+	remaining = victim->end - victim->next;
+	middle = victim->end;
+	end = victim->end;
+	if(remaining > clusterGIS_pool.grain) {
+		middle = victim->next + remaining / 2;
+		victim->end = middle;
+	}
+	pthread_mutex_unlock(&victim->lock);
+
+	/* only one lock is held at a time, so stealing threads cannot deadlock */
+	pthread_mutex_lock(&self->lock);
+	self->next = middle;
+	self->end = end;
+	pthread_mutex_unlock(&self->lock);
+
+	return 1;
+}
+
+/* clusterGIS_Work
+ *
+ * Runs the current loop a grain at a time from the worker's own range, then
+ * from ranges stolen from other workers until none is left
+ */
+static void clusterGIS_Work(struct clusterGIS_worker* self) {
+	int start;
+	int end;
+
+	while(1) {
+		pthread_mutex_lock(&self->lock);
+		start = self->next;
+		end = start + clusterGIS_pool.grain < self->end ? start + clusterGIS_pool.grain : self->end;
+		self->next = end;
+		pthread_mutex_unlock(&self->lock);
+
+		if(start < end) {
+			clusterGIS_pool.function(self->context, start, end, clusterGIS_pool.arg);
+		} else if(!clusterGIS_Steal(self)) {
+			return;
+		}
+	}
+}
+
+/* clusterGIS_Worker_main
+ *
+ * Thread function of the pool's workers, waits for loops to run
+ */
+static void* clusterGIS_Worker_main(void* arg) {
+	struct clusterGIS_worker* self = (struct clusterGIS_worker*) arg;
+	int generation = self->generation;
+
+	while(1) {
+		pthread_mutex_lock(&clusterGIS_pool.lock);
+		while(clusterGIS_pool.generation == generation && !clusterGIS_pool.shutdown) {
+			pthread_cond_wait(&clusterGIS_pool.start, &clusterGIS_pool.lock);
+		}
+		if(clusterGIS_pool.shutdown) {
+			pthread_mutex_unlock(&clusterGIS_pool.lock);
+			return NULL;
+		}
+		generation = clusterGIS_pool.generation;
+		pthread_mutex_unlock(&clusterGIS_pool.lock);
+
+		clusterGIS_Work(self);
+
+		pthread_mutex_lock(&clusterGIS_pool.lock);
+		clusterGIS_pool.running--;
+		if(clusterGIS_pool.running == 0) {
+			pthread_cond_signal(&clusterGIS_pool.done);
+		}
+		pthread_mutex_unlock(&clusterGIS_pool.lock);
+	}
+}
+
+/* clusterGIS_Set_threads
+ *
+ * Sets the number of threads each task uses for geometry construction,
+ * predicates and distance scans. Every thread gets its own GEOS context.
+ * Only the calling thread makes MPI calls.
+ *
+ * threads - number of threads, including the calling thread
+ */
+void clusterGIS_Set_threads(int threads) {
+	struct clusterGIS_worker* worker;
+	int i;
+
+	if(threads < 1) {
+		threads = 1;
+	}
+
+	/* stop the current pool */
+	if(clusterGIS_pool.workers != NULL) {
+		pthread_mutex_lock(&clusterGIS_pool.lock);
+		clusterGIS_pool.shutdown = 1;
+		pthread_cond_broadcast(&clusterGIS_pool.start);
+		pthread_mutex_unlock(&clusterGIS_pool.lock);
+		for(i = 1; i < clusterGIS_pool.threads; i++) {
+			pthread_join(clusterGIS_pool.workers[i].thread, NULL);
+			clusterGIS_Free_context(&clusterGIS_pool.workers[i].own_context);
+		}
+		for(i = 0; i < clusterGIS_pool.threads; i++) {
+			pthread_mutex_destroy(&clusterGIS_pool.workers[i].lock);
+		}
+		free(clusterGIS_pool.workers);
+		clusterGIS_pool.workers = NULL;
+		clusterGIS_pool.shutdown = 0;
+	}
+
+	clusterGIS_pool.threads = threads;
+	if(threads == 1) {
+		return;
+	}
+
+	clusterGIS_pool.workers = calloc(threads, sizeof(struct clusterGIS_worker));
+	for(i = 0; i < threads; i++) {
+		worker = &clusterGIS_pool.workers[i];
+		worker->generation = clusterGIS_pool.generation;
+		pthread_mutex_init(&worker->lock, NULL);
+		if(i == 0) {
+			worker->context = &clusterGIS_geos;
+		} else {
+			clusterGIS_Create_context(&worker->own_context);
+			worker->own_context.thread = i;
+			worker->context = &worker->own_context;
+			pthread_create(&worker->thread, NULL, clusterGIS_Worker_main, worker);
+		}
+	}
+}
+
+/* clusterGIS_Get_threads
+ *
+ * Returns the number of threads set with clusterGIS_Set_threads
+ */
+int clusterGIS_Get_threads(void) {
+	return clusterGIS_pool.threads;
+}
+
+/* clusterGIS_Parallel_for
+ *
+ * Calls function on ranges covering 0 to count - 1 using the thread pool.
+ * Ranges start out split evenly between the threads; threads which run out
+ * steal half of the largest range left. Returns when every range is done.
+ *
+ * count - number of items, e.g. records
+ * function - called with the calling thread's GEOS context, the start and
+ *            the end (exclusive) of a range, and arg
+ * arg - passed through to function
+ */
+void clusterGIS_Parallel_for(int count, clusterGIS_range_function function, void* arg) {
+	int threads = clusterGIS_pool.threads;
+	int i;
+
+	if(count <= 0) {
+		return;
+	}
+	if(threads == 1 || count < 2 * threads) {
+		function(&clusterGIS_geos, 0, count, arg);
+		return;
+	}
+
+	/* hand every thread an even share, in grains small enough to balance */
+	clusterGIS_pool.function = function;
+	clusterGIS_pool.arg = arg;
+	clusterGIS_pool.grain = count / (threads * 64);
+	if(clusterGIS_pool.grain < 1) {
+		clusterGIS_pool.grain = 1;
+	}
+	for(i = 0; i < threads; i++) {
+		clusterGIS_pool.workers[i].next = (long long) count * i / threads;
+		clusterGIS_pool.workers[i].end = (long long) count * (i + 1) / threads;
+	}
+
+	pthread_mutex_lock(&clusterGIS_pool.lock);
+	clusterGIS_pool.running = threads - 1;
+	clusterGIS_pool.generation++;
+	pthread_cond_broadcast(&clusterGIS_pool.start);
+	pthread_mutex_unlock(&clusterGIS_pool.lock);
+
+	clusterGIS_Work(&clusterGIS_pool.workers[0]);
+
+	pthread_mutex_lock(&clusterGIS_pool.lock);
+	while(clusterGIS_pool.running > 0) {
+		pthread_cond_wait(&clusterGIS_pool.done, &clusterGIS_pool.lock);
+	}
+	pthread_mutex_unlock(&clusterGIS_pool.lock);
+}
@@ -0,0 +1,186 @@
+#include "clustergis.h"
+#include "float.h"
+#include "string.h"
+
+#define RECORDS 9
+#define GROUPS 5
+#define AGGREGATES 4
+#define LANDUSE_COLUMN 2
+
+/* group columns 0 and 1, value column 2; some values are not numbers or
+ * are missing, and the last two records get group values holding the
+ * quoted separator "," which must not make them the same group */
+static char* records[RECORDS] = {
+	"\"x\",\"y\",\"1\"\n",
+	"\"x\",\"y\",\"2.5\"\n",
+	"\"x\",\"y\",\"abc\"\n",
+	"\"x\",\"y\"\n",
+	"\"x\",\"y\",\"\"\n",
+	"\"e\",\"f\",\"none\"\n",
+	"\"m\"\n",
+	"\"\",\"\",\"10\"\n",
+	"\"\",\"\",\"20\"\n"
+};
+
+/* group values and count, sum, min and max of each group */
+static char* groups[GROUPS][2] = {{"x", "y"}, {"e", "f"}, {"m", ""}, {"p\",\"q", "r"}, {"p", "q\",\"r"}};
+static double expected[GROUPS][AGGREGATES] = {
+	{5, 3.5, 1, 2.5},
+	{1, 0, DBL_MAX, -DBL_MAX},
+	{1, 0, DBL_MAX, -DBL_MAX},
+	{1, 10, 10, 10},
+	{1, 20, 20, 20}
+};
+
+static int field_equals(clusterGIS_dataset* dataset, int record, int column, char* value) {
+	return clusterGIS_Get_length(dataset, record, column) == (int) strlen(value) && memcmp(clusterGIS_Get_field(dataset, record, column), value, strlen(value)) == 0;
+}
+
+/* counts the output records which do not match their expected group, and
+ * the groups found */
+static int check_groups(clusterGIS_dataset* output, int* found) {
+	int wrong = 0;
+	int record;
+	int group;
+	int i;
+
+	*found = 0;
+	for(record = 0; record < output->size; record++) {
+		for(group = 0; group < GROUPS; group++) {
+			if(field_equals(output, record, 0, groups[group][0]) && field_equals(output, record, 1, groups[group][1])) {
+				break;
+			}
+		}
+		if(group == GROUPS || clusterGIS_Get_columns(output, record) != 2 + AGGREGATES) {
+			wrong++;
+			continue;
+		}
+		(*found)++;
+		for(i = 0; i < AGGREGATES; i++) {
+			if(strtod(clusterGIS_Get_field(output, record, 2 + i), NULL) != expected[group][i]) {
+				wrong++;
+			}
+		}
+	}
+
+	return wrong;
+}
+
+/* counts the groups of distributed, aggregated over all tasks, which differ
+ * from those of single, aggregated by this task alone */
+static int compare(clusterGIS_dataset* distributed, clusterGIS_dataset* single) {
+	int different = 0;
+	int record;
+	int other;
+	int i;
+
+	for(record = 0; record < distributed->size; record++) {
+		for(other = 0; other < single->size; other++) {
+			if(clusterGIS_Get_length(single, other, 0) == clusterGIS_Get_length(distributed, record, 0) && memcmp(clusterGIS_Get_field(single, other, 0), clusterGIS_Get_field(distributed, record, 0), clusterGIS_Get_length(single, other, 0)) == 0) {
+				break;
+			}
+		}
+		if(other == single->size) {
+			different++;
+			continue;
+		}
+		for(i = 1; i <= AGGREGATES; i++) {
+			if(clusterGIS_Get_length(single, other, i) != clusterGIS_Get_length(distributed, record, i) || memcmp(clusterGIS_Get_field(single, other, i), clusterGIS_Get_field(distributed, record, i), clusterGIS_Get_length(single, other, i)) != 0) {
+				different++;
+			}
+		}
+	}
+
+	return different;
+}
+
+int main(int argc, char** argv) {
+	clusterGIS_dataset* dataset;
+	clusterGIS_dataset* output;
+	clusterGIS_dataset* single;
+	int group_columns[2] = {0, 1};
+	int functions[AGGREGATES] = {CLUSTERGIS_AGGREGATE_COUNT, CLUSTERGIS_AGGREGATE_SUM, CLUSTERGIS_AGGREGATE_MIN, CLUSTERGIS_AGGREGATE_MAX};
+	int columns[AGGREGATES] = {0, 2, 2, 2};
+	int id_columns[AGGREGATES] = {0, 0, 0, 0};
+	int landuse_column = LANDUSE_COLUMN;
+	int wrong;
+	int found;
+	int total_wrong;
+	int total_found;
+	int total_groups;
+	int empty_groups;
+	int different;
+	int total_different;
+	int start;
+	int record;
+	int rank;
+	int tasks;
+	int i;
+
+	/* Process local arguments */
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s input\n", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &tasks);
+
+	/* deal the records out, with more tasks than records some have none */
+	dataset = clusterGIS_Create_dataset();
+	for(i = 0; i < RECORDS; i++) {
+		if(i % tasks == rank) {
+			start = 0;
+			record = clusterGIS_Append_record_from_csv(dataset, records[i], &start);
+			if(i == RECORDS - 2) {
+				clusterGIS_Set_field(dataset, record, 0, groups[3][0]);
+				clusterGIS_Set_field(dataset, record, 1, groups[3][1]);
+			} else if(i == RECORDS - 1) {
+				clusterGIS_Set_field(dataset, record, 0, groups[4][0]);
+				clusterGIS_Set_field(dataset, record, 1, groups[4][1]);
+			}
+		}
+	}
+	output = clusterGIS_Aggregate(MPI_COMM_WORLD, dataset, group_columns, 2, functions, columns, AGGREGATES);
+	wrong = check_groups(output, &found);
+	MPI_Allreduce(&wrong, &total_wrong, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(&found, &total_found, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(&output->size, &total_groups, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	clusterGIS_Free_dataset(output);
+	clusterGIS_Free_dataset(dataset);
+
+	/* a dataset with no records has no groups */
+	dataset = clusterGIS_Create_dataset();
+	output = clusterGIS_Aggregate(MPI_COMM_WORLD, dataset, group_columns, 2, functions, columns, AGGREGATES);
+	MPI_Allreduce(&output->size, &empty_groups, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	clusterGIS_Free_dataset(output);
+	clusterGIS_Free_dataset(dataset);
+
+	/* the groups of a file are the same aggregated by every task or by one;
+	 * the ids are integers, so their sums are exact in any order */
+	dataset = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+	output = clusterGIS_Aggregate(MPI_COMM_WORLD, dataset, &landuse_column, 1, functions, id_columns, AGGREGATES);
+	clusterGIS_Free_dataset(dataset);
+	dataset = clusterGIS_Load_csv_distributed(MPI_COMM_SELF, argv[1]);
+	single = clusterGIS_Aggregate(MPI_COMM_SELF, dataset, &landuse_column, 1, functions, id_columns, AGGREGATES);
+	different = compare(output, single);
+	MPI_Allreduce(&output->size, &i, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	if(i != single->size) {
+		different++;
+	}
+	MPI_Allreduce(&different, &total_different, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+	if(rank == 0) {
+		printf("Groups: %d of %d found, %d wrong, %d from no records, %d of %d file groups different\n", total_found, total_groups, total_wrong, empty_groups, total_different, single->size);
+		if(total_found != GROUPS || total_groups != GROUPS || total_wrong > 0 || empty_groups > 0 || total_different > 0) {
+			printf("AGGREGATES ARE WRONG\n");
+		}
+	}
+
+	clusterGIS_Free_dataset(single);
+	clusterGIS_Free_dataset(dataset);
+	clusterGIS_Free_dataset(output);
+	clusterGIS_Finalize();
+	return 0;
+}
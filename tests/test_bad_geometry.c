@@ -0,0 +1,118 @@
+#include "clustergis.h"
+#include "float.h"
+
+#define GEOMETRY_COLUMN 1
+#define BAD_RECORDS 4
+#define EMPTY_RECORDS 3
+
+/* geometry fields which are not valid WKT; the first two still have
+ * coordinates, so only parsing them shows they are bad */
+static char* bad_records[BAD_RECORDS] = {
+	"\"9000000\",\"POLYGON((-112.1 33.4,-112.0 33.4,-112.0\",\"R\",\"1\"\n",
+	"\"9000001\",\"POLYGON((-112.1 33.4,-112.0 33.4,-112.0 33.5))\",\"R\",\"1\"\n",
+	"\"9000002\",\"\",\"R\",\"1\"\n",
+	"\"9000003\",\"not a geometry\",\"R\",\"1\"\n"
+};
+
+/* valid WKT with no coordinates, which has no envelope */
+static char* empty_record = "\"9000004\",\"POLYGON EMPTY\",\"R\",\"1\"\n";
+
+/* adds the bad records to the end of the dataset */
+static void add_bad_records(clusterGIS_dataset* dataset) {
+	int start;
+	int i;
+
+	for(i = 0; i < BAD_RECORDS; i++) {
+		start = 0;
+		clusterGIS_Append_record_from_csv(dataset, bad_records[i], &start);
+	}
+}
+
+/* filters the dataset with a box around every valid record, so only the
+ * bad records should be removed */
+static int filter(clusterGIS_dataset* dataset, int predicate) {
+	GEOSGeometry* box;
+	int kept;
+	int total;
+
+	box = GEOSGeom_createRectangle_r(clusterGIS_geos.handle, -180, -90, 180, 90);
+	kept = clusterGIS_Filter_geometry(dataset, box, predicate);
+	GEOSGeom_destroy_r(clusterGIS_geos.handle, box);
+
+	MPI_Allreduce(&kept, &total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	return total;
+}
+
+int main(int argc, char** argv) {
+	clusterGIS_dataset* deferred;
+	clusterGIS_dataset* created;
+	clusterGIS_dataset* empty;
+	double* extent;
+	int total;
+	int deferred_kept;
+	int created_kept;
+	int empty_total;
+	int bad_extents;
+	int start;
+	int rank;
+	int tasks;
+	int i;
+
+	/* Process local arguments */
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s input\n", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &tasks);
+
+	/* records appended to a deferred dataset are deferred too */
+	deferred = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+	MPI_Allreduce(&deferred->size, &total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	clusterGIS_Defer_wkt_geometries(deferred, GEOMETRY_COLUMN);
+	add_bad_records(deferred);
+	deferred_kept = filter(deferred, CLUSTERGIS_PREDICATE_INTERSECTS);
+
+	/* bad records added before the geometries are created get none */
+	created = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+	add_bad_records(created);
+	clusterGIS_Create_wkt_geometries(created, GEOMETRY_COLUMN);
+	created_kept = filter(created, CLUSTERGIS_PREDICATE_COVERS);
+
+	/* empty geometries are moved but have no envelope, so every task's
+	 * extent must stay empty */
+	empty = clusterGIS_Create_dataset();
+	for(i = 0; i < EMPTY_RECORDS; i++) {
+		start = 0;
+		clusterGIS_Append_record_from_csv(empty, empty_record, &start);
+	}
+	clusterGIS_Create_wkt_geometries(empty, GEOMETRY_COLUMN);
+	clusterGIS_Repartition_spatial(MPI_COMM_WORLD, empty);
+	MPI_Allreduce(&empty->size, &empty_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	bad_extents = 0;
+	for(i = 0; i < empty->extents_count; i++) {
+		extent = &empty->extents[4 * i];
+		if(extent[0] != DBL_MAX || extent[1] != DBL_MAX || extent[2] != -DBL_MAX || extent[3] != -DBL_MAX) {
+			bad_extents++;
+		}
+	}
+
+	if(rank == 0) {
+		printf("Count: %d deferred kept: %d created kept: %d\n", total, deferred_kept, created_kept);
+		if(deferred_kept != total || created_kept != total) {
+			printf("BAD GEOMETRIES NOT DROPPED\n");
+		}
+		printf("Empty geometries: %d, %d tasks with an extent\n", empty_total, bad_extents);
+		if(empty_total != EMPTY_RECORDS * tasks || bad_extents > 0) {
+			printf("EMPTY GEOMETRIES BROKE THE EXTENTS\n");
+		}
+	}
+
+	clusterGIS_Free_dataset(deferred);
+	clusterGIS_Free_dataset(created);
+	clusterGIS_Free_dataset(empty);
+	clusterGIS_Finalize();
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include "clustergis.h"
+
+int main(int argc, char** argv) {
+	clusterGIS_dataset* dataset;
+	clusterGIS_dataset* mapped;
+	clusterGIS_dataset* read;
+	clusterGIS_dataset* half;
+	MPI_Comm half_comm;
+	int total_before;
+	int total_mapped;
+	int total_read;
+	int largest_block;
+	int unbalanced;
+	int total_unbalanced;
+	int half_size;
+	int rank;
+	int tasks;
+	int map;
+
+	/* Process local arguments */
+	if (argc != 4) {
+		fprintf(stderr, "Usage: %s input binary output\n", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &tasks);
+
+	dataset = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+	clusterGIS_Create_wkt_geometries(dataset, 1);
+	MPI_Allreduce(&dataset->size, &total_before, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(&dataset->size, &largest_block, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	clusterGIS_Write_binary(MPI_COMM_WORLD, argv[2], dataset);
+
+	/* load it both ways, the mapped copy is written back out as csv */
+	map = 1;
+	mapped = clusterGIS_Load_binary(MPI_COMM_WORLD, argv[2], map);
+	MPI_Reduce(&mapped->size, &total_mapped, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	read = clusterGIS_Load_binary(MPI_COMM_WORLD, argv[2], !map);
+	MPI_Reduce(&read->size, &total_read, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	printf("%d: %d records, %d geometries in (%f %f, %f %f)\n", rank, mapped->size, mapped->size > 0 && clusterGIS_Get_geometry(mapped, 0) != NULL, mapped->extents[4 * rank], mapped->extents[4 * rank + 1], mapped->extents[4 * rank + 2], mapped->extents[4 * rank + 3]);
+	clusterGIS_Write_csv_distributed(MPI_COMM_WORLD, argv[3], mapped);
+
+	/* as many readers as writers each get their own block back */
+	unbalanced = mapped->size != dataset->size || read->size != dataset->size;
+
+	/* half as many readers share the blocks out, none more than a block
+	 * away from an even share */
+	MPI_Comm_split(MPI_COMM_WORLD, rank < (tasks + 1) / 2, rank, &half_comm);
+	if(rank < (tasks + 1) / 2) {
+		MPI_Comm_size(half_comm, &half_size);
+		half = clusterGIS_Load_binary(half_comm, argv[2], map);
+		if(half->size > (total_before + half_size - 1) / half_size + largest_block || half->size < total_before / half_size - largest_block) {
+			unbalanced = 1;
+		}
+		if(half_size < tasks && half->size == 0 && total_before >= tasks) {
+			unbalanced = 1;
+		}
+		printf("%d: %d records of %d when read by %d tasks\n", rank, half->size, total_before, half_size);
+		clusterGIS_Free_dataset(half);
+	}
+	MPI_Comm_free(&half_comm);
+	MPI_Reduce(&unbalanced, &total_unbalanced, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	if(rank == 0) {
+		printf("Count before: %d mapped: %d read: %d\n", total_before, total_mapped, total_read);
+		if(total_before != total_mapped || total_before != total_read) {
+			printf("RECORDS LOST IN BINARY FILE\n");
+		}
+		if(total_unbalanced > 0) {
+			printf("%d TASKS LOADED AN UNBALANCED SHARE\n", total_unbalanced);
+		}
+	}
+
+	clusterGIS_Free_dataset(read);
+	clusterGIS_Free_dataset(mapped);
+	clusterGIS_Free_dataset(dataset);
+	clusterGIS_Finalize();
+	return 0;
+}
@@ -0,0 +1,49 @@
+#include "clustergis.h"
+
+int main(int argc, char** argv) {
+	clusterGIS_dataset* dataset;
+	int count;
+	int total_before;
+	int total_after;
+	int rank;
+	int tasks;
+	int* ranks;
+	int overlapping;
+	double* extent;
+
+	/* Process local arguments */
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s input\n", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &tasks);
+
+	dataset = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+	clusterGIS_Create_wkt_geometries(dataset, 1);
+	MPI_Reduce(&dataset->size, &total_before, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	clusterGIS_Repartition_spatial(MPI_COMM_WORLD, dataset);
+	count = dataset->size;
+	MPI_Reduce(&count, &total_after, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	/* every task's own extent must overlap itself and cover its records */
+	extent = &dataset->extents[4 * rank];
+	ranks = malloc(tasks * sizeof(int));
+	overlapping = clusterGIS_Overlapping_ranks(dataset, extent[0], extent[1], extent[2], extent[3], ranks);
+	printf("%d: %d records in (%f %f, %f %f), overlaps %d tasks\n", rank, count, extent[0], extent[1], extent[2], extent[3], overlapping);
+
+	if(rank == 0) {
+		printf("Count before: %d after: %d\n", total_before, total_after);
+		if(total_before != total_after) {
+			printf("RECORDS LOST IN REPARTITION\n");
+		}
+	}
+
+	free(ranks);
+	clusterGIS_Free_dataset(dataset);
+	clusterGIS_Finalize();
+	return 0;
+}
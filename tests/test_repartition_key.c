@@ -0,0 +1,59 @@
+#include "clustergis.h"
+
+#define ZONE_COLUMN 3
+#define ZONES 100
+
+int main(int argc, char** argv) {
+	clusterGIS_dataset* dataset;
+	int total_before;
+	int total_after;
+	int present[ZONES];
+	int holders[ZONES];
+	int record;
+	int zone;
+	int split;
+	int rank;
+
+	/* Process local arguments */
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s input\n", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	dataset = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+	MPI_Reduce(&dataset->size, &total_before, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	clusterGIS_Repartition_by_key(MPI_COMM_WORLD, dataset, ZONE_COLUMN);
+	MPI_Reduce(&dataset->size, &total_after, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	/* every zone must be held by at most one task */
+	for(zone = 0; zone < ZONES; zone++) {
+		present[zone] = 0;
+	}
+	for(record = 0; record < dataset->size; record++) {
+		present[atoi(clusterGIS_Get_field(dataset, record, ZONE_COLUMN)) % ZONES] = 1;
+	}
+	MPI_Reduce(present, holders, ZONES, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	printf("%d: %d records\n", rank, dataset->size);
+
+	if(rank == 0) {
+		split = 0;
+		for(zone = 0; zone < ZONES; zone++) {
+			if(holders[zone] > 1) {
+				printf("Zone %d is on %d tasks\n", zone, holders[zone]);
+				split++;
+			}
+		}
+		printf("Count before: %d after: %d, %d zones split\n", total_before, total_after, split);
+		if(total_before != total_after) {
+			printf("RECORDS LOST IN REPARTITION\n");
+		}
+	}
+
+	clusterGIS_Free_dataset(dataset);
+	clusterGIS_Finalize();
+	return 0;
+}
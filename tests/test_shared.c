@@ -0,0 +1,156 @@
+#include "clustergis.h"
+#include "string.h"
+
+#define ZONE_COLUMN 2
+
+/* returns a record's fields joined by '\n', which no field contains */
+static char* record_text(clusterGIS_dataset* dataset, int record) {
+	char* text;
+	int length;
+	int column;
+
+	length = 0;
+	for(column = 0; column < clusterGIS_Get_columns(dataset, record); column++) {
+		length += clusterGIS_Get_length(dataset, record, column) + 1;
+	}
+	text = malloc(length + 1);
+	length = 0;
+	for(column = 0; column < clusterGIS_Get_columns(dataset, record); column++) {
+		memcpy(text + length, clusterGIS_Get_field(dataset, record, column), clusterGIS_Get_length(dataset, record, column));
+		length += clusterGIS_Get_length(dataset, record, column);
+		text[length++] = '\n';
+	}
+	text[length] = '\0';
+
+	return text;
+}
+
+static int compare_text(const void* a, const void* b) {
+	return strcmp(*(char**) a, *(char**) b);
+}
+
+/* counts the records of distributed, this task's share of a file, which
+ * are not in shared, a copy of the whole file; the distributed load need
+ * not keep the order of the file */
+static int compare(clusterGIS_dataset* shared, clusterGIS_dataset* distributed) {
+	char** texts;
+	char* text;
+	int different;
+	int record;
+
+	texts = malloc((shared->size + 1) * sizeof(char*));
+	for(record = 0; record < shared->size; record++) {
+		texts[record] = record_text(shared, record);
+	}
+	qsort(texts, shared->size, sizeof(char*), compare_text);
+
+	different = 0;
+	for(record = 0; record < distributed->size; record++) {
+		text = record_text(distributed, record);
+		if(bsearch(&text, texts, shared->size, sizeof(char*), compare_text) == NULL) {
+			different++;
+		}
+		free(text);
+	}
+
+	for(record = 0; record < shared->size; record++) {
+		free(texts[record]);
+	}
+	free(texts);
+	return different;
+}
+
+/* loads a file both ways and counts the differences over all tasks */
+static int check(char* filename, clusterGIS_load_options* options, int* total) {
+	clusterGIS_dataset* shared;
+	clusterGIS_dataset* distributed;
+	int different;
+	int total_different;
+
+	shared = clusterGIS_Load_csv_shared_options(MPI_COMM_WORLD, filename, options);
+	distributed = clusterGIS_Load_csv_distributed_options(MPI_COMM_WORLD, filename, options);
+	MPI_Allreduce(&distributed->size, total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	different = compare(shared, distributed);
+	if(shared->size != *total) {
+		different++;
+	}
+	MPI_Allreduce(&different, &total_different, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+	clusterGIS_Free_dataset(distributed);
+	clusterGIS_Free_dataset(shared);
+	return total_different;
+}
+
+int main(int argc, char** argv) {
+	clusterGIS_load_options* options;
+	int columns[2] = {0, ZONE_COLUMN};
+	FILE* input;
+	FILE* output;
+	char* text;
+	long size;
+	int total;
+	int filtered;
+	int different;
+	int filtered_different;
+	int unfiltered;
+	int unfiltered_different;
+	int rank;
+
+	/* Process local arguments */
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s input output\n", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	/* copy the input without its last '\n' */
+	if(rank == 0) {
+		input = fopen(argv[1], "r");
+		fseek(input, 0, SEEK_END);
+		size = ftell(input);
+		fseek(input, 0, SEEK_SET);
+		text = malloc(size);
+		size = fread(text, 1, size, input);
+		fclose(input);
+		while(size > 0 && text[size - 1] == '\n') {
+			size--;
+		}
+		output = fopen(argv[2], "w");
+		fwrite(text, 1, size, output);
+		fclose(output);
+		free(text);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+
+	different = check(argv[2], NULL, &total);
+
+	/* the value filter and projection apply to shared loads too */
+	options = clusterGIS_Create_load_options();
+	options->value_column = ZONE_COLUMN;
+	options->prefix = "R";
+	options->columns = columns;
+	options->columns_count = 2;
+	filtered_different = check(argv[2], options, &filtered);
+	clusterGIS_Free_load_options(options);
+
+	/* a value column without a prefix filters nothing */
+	options = clusterGIS_Create_load_options();
+	options->value_column = ZONE_COLUMN;
+	unfiltered_different = check(argv[2], options, &unfiltered);
+	if(unfiltered != total) {
+		unfiltered_different++;
+	}
+	clusterGIS_Free_load_options(options);
+
+	if(rank == 0) {
+		printf("Count: %d, %d different, filtered: %d, %d different, no prefix: %d, %d different\n", total, different, filtered, filtered_different, unfiltered, unfiltered_different);
+		if(different > 0 || filtered_different > 0 || unfiltered_different > 0) {
+			printf("SHARED LOAD DIFFERS FROM DISTRIBUTED LOAD\n");
+		}
+	}
+
+	clusterGIS_Finalize();
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include "clustergis.h"
+#include "float.h"
+#include "string.h"
+
+#define ENVELOPES 1003
+#define WINDOWS 50
+#define DISTANCE 3.0
+
+/* the envelope kernels written out plainly, to check the vector ones */
+static int reference(clusterGIS_envelopes* envelopes, int start, int end, double* window, double distance, char* matches) {
+	double dx;
+	double dy;
+	int count = 0;
+	int i;
+
+	for(i = start; i < end; i++) {
+		if(distance < 0) {
+			matches[i - start] = envelopes->xmin[i] <= window[2] && envelopes->xmax[i] >= window[0] && envelopes->ymin[i] <= window[3] && envelopes->ymax[i] >= window[1];
+		} else {
+			dx = window[0] - envelopes->xmax[i];
+			if(envelopes->xmin[i] - window[2] > dx) dx = envelopes->xmin[i] - window[2];
+			if(dx < 0) dx = 0;
+			dy = window[1] - envelopes->ymax[i];
+			if(envelopes->ymin[i] - window[3] > dy) dy = envelopes->ymin[i] - window[3];
+			if(dy < 0) dy = 0;
+			matches[i - start] = dx * dx + dy * dy <= distance * distance;
+		}
+		count += matches[i - start];
+	}
+
+	return count;
+}
+
+int main(int argc, char** argv) {
+	clusterGIS_envelopes envelopes;
+	double window[4];
+	char expected[ENVELOPES];
+	char matches[ENVELOPES];
+	/* ranges starting and ending off a vector boundary, and ones shorter
+	 * than a vector */
+	int ranges[][2] = {{0, ENVELOPES}, {1, ENVELOPES}, {3, ENVELOPES - 2}, {5, 6}, {7, 10}, {9, 9}};
+	int expected_count;
+	int count;
+	int different;
+	int checked;
+	int simd;
+	int best;
+	int range;
+	int w;
+	int i;
+	int rank;
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	envelopes.xmin = malloc(ENVELOPES * sizeof(double));
+	envelopes.ymin = malloc(ENVELOPES * sizeof(double));
+	envelopes.xmax = malloc(ENVELOPES * sizeof(double));
+	envelopes.ymax = malloc(ENVELOPES * sizeof(double));
+	envelopes.size = ENVELOPES;
+	srand(7);
+	for(i = 0; i < ENVELOPES; i++) {
+		if(i % 7 == 3) {
+			/* a record without a geometry */
+			envelopes.xmin[i] = DBL_MAX;
+			envelopes.ymin[i] = DBL_MAX;
+			envelopes.xmax[i] = -DBL_MAX;
+			envelopes.ymax[i] = -DBL_MAX;
+		} else {
+			envelopes.xmin[i] = rand() % 100;
+			envelopes.ymin[i] = rand() % 100;
+			envelopes.xmax[i] = envelopes.xmin[i] + rand() % 5;
+			envelopes.ymax[i] = envelopes.ymin[i] + rand() % 5;
+		}
+	}
+
+	best = clusterGIS_Get_simd();
+	different = 0;
+	checked = 0;
+	for(simd = CLUSTERGIS_SIMD_SCALAR; simd <= best; simd++) {
+		clusterGIS_Set_simd(simd);
+		srand(11);
+		for(w = 0; w < WINDOWS; w++) {
+			window[0] = rand() % 100;
+			window[1] = rand() % 100;
+			window[2] = window[0] + rand() % 20;
+			window[3] = window[1] + rand() % 20;
+			for(range = 0; range < (int) (sizeof(ranges) / sizeof(ranges[0])); range++) {
+				expected_count = reference(&envelopes, ranges[range][0], ranges[range][1], window, -1, expected);
+				count = clusterGIS_Envelopes_window(&envelopes, ranges[range][0], ranges[range][1], window, matches);
+				if(count != expected_count || memcmp(matches, expected, ranges[range][1] - ranges[range][0]) != 0) {
+					different++;
+				}
+				expected_count = reference(&envelopes, ranges[range][0], ranges[range][1], window, DISTANCE, expected);
+				count = clusterGIS_Envelopes_distance(&envelopes, ranges[range][0], ranges[range][1], window, DISTANCE, matches);
+				if(count != expected_count || memcmp(matches, expected, ranges[range][1] - ranges[range][0]) != 0) {
+					different++;
+				}
+				checked += 2;
+			}
+		}
+	}
+	clusterGIS_Set_simd(best);
+
+	if(rank == 0) {
+		printf("Checked: %d at levels up to %d, %d different\n", checked, best, different);
+		if(different > 0) {
+			printf("SIMD ENVELOPE FILTER DIFFERS FROM SCALAR\n");
+		}
+	}
+
+	free(envelopes.xmin);
+	free(envelopes.ymin);
+	free(envelopes.xmax);
+	free(envelopes.ymax);
+	clusterGIS_Finalize();
+	return 0;
+}
@@ -0,0 +1,75 @@
+#include "clustergis.h"
+#include "limits.h"
+
+#define ZONE_COLUMN 3
+
+int main(int argc, char** argv) {
+	clusterGIS_dataset* dataset;
+	int total_before;
+	int total_after;
+	int record;
+	int unsorted;
+	int total_unsorted;
+	long long key;
+	long long last_key;
+	long long previous_key;
+	MPI_Status status;
+	int rank;
+	int tasks;
+
+	/* Process local arguments */
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s input\n", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &tasks);
+
+	dataset = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+	MPI_Reduce(&dataset->size, &total_before, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	clusterGIS_Sort(MPI_COMM_WORLD, dataset, ZONE_COLUMN, CLUSTERGIS_SORT_INTEGER);
+	MPI_Reduce(&dataset->size, &total_after, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+	/* keys must not decrease within a task, nor from one task to the next */
+	unsorted = 0;
+	last_key = LLONG_MIN;
+	for(record = 0; record < dataset->size; record++) {
+		key = atoll(clusterGIS_Get_field(dataset, record, ZONE_COLUMN));
+		if(key < last_key) {
+			unsorted++;
+		}
+		last_key = key;
+	}
+
+	/* an empty task passes on the last key of the task before it */
+	previous_key = LLONG_MIN;
+	if(rank > 0) {
+		MPI_Recv(&previous_key, 1, MPI_LONG_LONG, rank - 1, 99, MPI_COMM_WORLD, &status);
+	}
+	if(dataset->size > 0 && atoll(clusterGIS_Get_field(dataset, 0, ZONE_COLUMN)) < previous_key) {
+		printf("%d: first key is less than the last key of task %d\n", rank, rank - 1);
+		unsorted++;
+	}
+	if(rank < tasks - 1) {
+		if(dataset->size == 0) {
+			last_key = previous_key;
+		}
+		MPI_Send(&last_key, 1, MPI_LONG_LONG, rank + 1, 99, MPI_COMM_WORLD);
+	}
+	printf("%d: %d records\n", rank, dataset->size);
+
+	MPI_Reduce(&unsorted, &total_unsorted, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	if(rank == 0) {
+		printf("Count before: %d after: %d, %d out of order\n", total_before, total_after, total_unsorted);
+		if(total_before != total_after) {
+			printf("RECORDS LOST IN SORT\n");
+		}
+	}
+
+	clusterGIS_Free_dataset(dataset);
+	clusterGIS_Finalize();
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include "clustergis.h"
+#include "string.h"
+
+int main(int argc, char** argv) {
+	clusterGIS_dataset* dataset;
+	clusterGIS_dataset* batch;
+	clusterGIS_csv_stream* stream;
+	clusterGIS_load_options* options;
+	int record;
+	int count;
+	int batches;
+	int largest;
+	int mismatches;
+	int total_loaded;
+	int total_streamed;
+	int rank;
+
+	/* Process local arguments */
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s input\n", argv[0]);
+		exit(1);
+	}
+
+	clusterGIS_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	dataset = clusterGIS_Load_csv_distributed(MPI_COMM_WORLD, argv[1]);
+
+	/* stream the same records in small batches, they must come in the same order */
+	options = clusterGIS_Create_load_options();
+	options->buffer_size = 64 * 1024;
+	stream = clusterGIS_Open_csv_stream_options(MPI_COMM_WORLD, argv[1], options);
+	batch = clusterGIS_Create_dataset();
+	count = 0;
+	batches = 0;
+	largest = 0;
+	mismatches = 0;
+	while(clusterGIS_Next_batch(stream, batch) > 0) {
+		for(record = 0; record < batch->size; record++) {
+			if(count + record >= dataset->size || strcmp(clusterGIS_Get_field(batch, record, 0), clusterGIS_Get_field(dataset, count + record, 0)) != 0) {
+				mismatches++;
+			}
+		}
+		count += batch->size;
+		batches++;
+		if(batch->size > largest) {
+			largest = batch->size;
+		}
+	}
+	clusterGIS_Close_csv_stream(stream);
+	clusterGIS_Free_load_options(options);
+
+	printf("%d: %d records in %d batches of at most %d, %d mismatches\n", rank, count, batches, largest, mismatches);
+
+	MPI_Reduce(&dataset->size, &total_loaded, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	MPI_Reduce(&count, &total_streamed, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	if(rank == 0) {
+		printf("Count loaded: %d streamed: %d\n", total_loaded, total_streamed);
+		if(total_loaded != total_streamed) {
+			printf("RECORDS LOST IN STREAM\n");
+		}
+	}
+
+	clusterGIS_Free_dataset(batch);
+	clusterGIS_Free_dataset(dataset);
+	clusterGIS_Finalize();
+	return 0;
+}
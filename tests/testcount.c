@@ -24,7 +24,8 @@ int main(int argc, char** argv) {
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &tasks);
 
-	record = dataset->data;
+	/* walk the records as a list, which must be linked explicitly */
+	record = clusterGIS_Link_records(dataset);
 	last_id = atoi(record->data[0]) - 1;
 	count = 0;
 	while(record != NULL) {